@@ -120,6 +120,8 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int __vmstat(unsigned int *counts, int ncounts);
+int setshare(int tickets);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
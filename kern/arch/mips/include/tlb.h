@@ -24,20 +24,28 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   TLB_SetASID: make ASID the address space ID that lookups match
+ *        against, by loading it into the PID field of ENTRYHI.
+ *
+ *        IMPORTANT NOTE: TLB_Random, TLB_Write, TLB_Probe and TLB_Read
+ *        all overwrite ENTRYHI, PID field included. Pass the current
+ *        ASID in the entry, or call TLB_SetASID again afterwards.
  */
 
 void TLB_Random(u_int32_t entryhi, u_int32_t entrylo);
 void TLB_Write(u_int32_t entryhi, u_int32_t entrylo, u_int32_t index);
 void TLB_Read(u_int32_t *entryhi, u_int32_t *entrylo, u_int32_t index);
 int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
+void TLB_SetASID(u_int32_t asid);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID, in TLBHI_PID. An
+ * entry only matches when its PID equals the one in ENTRYHI (see
+ * TLB_SetASID), unless TLBLO_GLOBAL is set; we never set that. The
+ * bits that aren't assigned a meaning can be left zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -49,7 +57,8 @@ int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PID_SHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
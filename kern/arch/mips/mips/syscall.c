@@ -7,6 +7,7 @@
 #include <kern/callno.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * System call handler.
@@ -100,8 +101,20 @@ mips_syscall(struct trapframe *tf)
 	    case SYS_execv:
         	err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
         	break;
+	    case SYS_setshare:
+		err = sys_setshare(tf->tf_a0, &retval);
+		break;
 
 	    #endif /* OPT_A2 */
+
+	    #if OPT_A3
+	    case SYS_sbrk:
+		err = sys_sbrk(tf->tf_a0, &retval);
+		break;
+	    case SYS___vmstat:
+		err = sys___vmstat((userptr_t)tf->tf_a0, tf->tf_a1, &retval);
+		break;
+	    #endif /* OPT_A3 */
  
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
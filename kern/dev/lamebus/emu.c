@@ -438,10 +438,10 @@ emufs_reclaim(struct vnode *v)
 	int ix, i, num, result;
 
 	lock_acquire(ef->ef_emu->e_lock);
-	lock_acquire(ev->ev_v.vn_countlock);
+	mutex_acquire(ev->ev_v.vn_countlock);
 
 	if (ev->ev_v.vn_refcount != 1) {
-		lock_release(ev->ev_v.vn_countlock);
+		mutex_release(ev->ev_v.vn_countlock);
 		lock_release(ef->ef_emu->e_lock);
 		return EBUSY;
 	}
@@ -450,7 +450,7 @@ emufs_reclaim(struct vnode *v)
 	 * Since we hold e_lock and are the last ref, nobody can increment
 	 * the refcount, so we can release vn_countlock.
 	 */
-	lock_release(ev->ev_v.vn_countlock);
+	mutex_release(ev->ev_v.vn_countlock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
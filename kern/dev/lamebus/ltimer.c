@@ -4,6 +4,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <machine/spl.h>
 #include <machine/bus.h>
 #include <lamebus/ltimer.h>
 #include "autoconf.h"
@@ -22,6 +23,65 @@
 
 static int haveclock=0;
 
+/* The timer driving hardclock, and when it last went off. */
+static struct ltimer_softc *hardclock_lt;
+static time_t hc_lastsecs;
+static u_int32_t hc_lastnsecs;
+static u_int32_t hc_carry;	/* nanoseconds short of a whole tick */
+
+#define TICK_NSECS	(1000000000/HZ)
+
+/*
+ * Put the nanoseconds from SECS1/NSECS1 to SECS2/NSECS2 in *NS. Only
+ * gaps of up to two (and a bit) seconds fit in 32 bits; returns 1 if
+ * the gap is longer than that, -1 if the second time is the earlier,
+ * and 0 otherwise.
+ */
+static
+int
+hardclock_nsecs(time_t secs1, u_int32_t nsecs1,
+		time_t secs2, u_int32_t nsecs2, u_int32_t *ns)
+{
+	if (secs2 < secs1 || (secs2 == secs1 && nsecs2 < nsecs1)) {
+		return -1;
+	}
+	if (secs2 - secs1 > 2) {
+		return 1;
+	}
+	*ns = (u_int32_t)(secs2 - secs1) * 1000000000U + nsecs2 - nsecs1;
+	return 0;
+}
+
+/*
+ * Timer interrupt latency: how long after the countdown was due to
+ * expire the interrupt actually got handled. Mostly this is time spent
+ * at splhigh somewhere else. Bucket i counts latencies under 2^i usec;
+ * the last bucket takes everything longer.
+ */
+#define LATENCY_BUCKETS	20
+
+static time_t hc_duesecs;		/* when the timer is next due */
+static u_int32_t hc_duensecs;
+static u_int32_t hc_interval;		/* nanoseconds between interrupts */
+static u_int32_t hc_latency[LATENCY_BUCKETS];
+static u_int32_t hc_maxlatency;		/* usec */
+
+/*
+ * Set the next due time to NS nanoseconds after SECS/NSECS.
+ */
+static
+void
+hardclock_setdue(time_t secs, u_int32_t nsecs, u_int32_t ns)
+{
+	nsecs += ns;
+	while (nsecs >= 1000000000) {
+		nsecs -= 1000000000;
+		secs++;
+	}
+	hc_duesecs = secs;
+	hc_duensecs = nsecs;
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -35,6 +95,10 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	if (!haveclock) {
 		haveclock = 1;
 		lt->lt_hardclock = 1;
+		hardclock_lt = lt;
+		ltimer_gettime(lt, &hc_lastsecs, &hc_lastnsecs);
+		hc_interval = TICK_NSECS;
+		hardclock_setdue(hc_lastsecs, hc_lastnsecs, hc_interval);
 
 		/*
 		 * Arm the timer to go off HZ times a second, and set
@@ -58,6 +122,159 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	return 0;
 }
 
+/*
+ * Rearm the hardclock timer to go off every NTICKS ticks. Writing the
+ * count restarts the countdown, so time already gone by in the current
+ * interval is picked up by hardclock_elapsed at the next interrupt.
+ */
+void
+hardclock_setinterval(unsigned nticks)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	if (hardclock_lt == NULL) {
+		return;
+	}
+	assert(nticks > 0 && nticks <= HZ);
+	bus_write_register(hardclock_lt->lt_bus, hardclock_lt->lt_buspos,
+			   LT_REG_COUNT, nticks * (LT_GRANULARITY/HZ));
+
+	ltimer_gettime(hardclock_lt, &secs, &nsecs);
+	hc_interval = nticks * TICK_NSECS;
+	hardclock_setdue(secs, nsecs, hc_interval);
+}
+
+/*
+ * Read the clock of the hardclock timer, for CPU accounting. This is
+ * called on every context switch, so it goes straight to the timer
+ * rather than through gettime().
+ */
+void
+hardclock_gettime(time_t *secs, u_int32_t *nsecs)
+{
+	if (hardclock_lt == NULL) {
+		*secs = 0;
+		*nsecs = 0;
+		return;
+	}
+	ltimer_gettime(hardclock_lt, secs, nsecs);
+}
+
+/*
+ * Record how late the interrupt at SECS/NSECS was, and work out when
+ * the next one is due. The timer reloads itself, so that is one
+ * interval on from when this one was due, not from now.
+ */
+static
+void
+hardclock_latency(time_t secs, u_int32_t nsecs)
+{
+	u_int32_t ns, us;
+	int i;
+
+	switch (hardclock_nsecs(hc_duesecs, hc_duensecs, secs, nsecs, &ns)) {
+	    case -1:
+		/* Early; the clock and the countdown don't quite agree. */
+		us = 0;
+		break;
+	    case 0:
+		us = ns / 1000;
+		break;
+	    default:
+		/* Way off (or the clock was set); start over from now. */
+		hardclock_setdue(secs, nsecs, hc_interval);
+		return;
+	}
+
+	for (i=0; i<LATENCY_BUCKETS-1 && us >= (1U << i); i++);
+	hc_latency[i]++;
+	if (us > hc_maxlatency) {
+		hc_maxlatency = us;
+	}
+
+	hardclock_setdue(hc_duesecs, hc_duensecs, hc_interval);
+	while (hc_duesecs < secs ||
+	       (hc_duesecs == secs && hc_duensecs <= nsecs)) {
+		/* Missed whole interrupts. */
+		hardclock_setdue(hc_duesecs, hc_duensecs, hc_interval);
+	}
+}
+
+/*
+ * Print the timer interrupt latency histogram, and clear it if
+ * CLEAR is set.
+ */
+void
+hardclock_printlatency(int clear)
+{
+	u_int32_t counts[LATENCY_BUCKETS], max, total;
+	int i, last, spl;
+
+	spl = splhigh();
+	total = 0;
+	for (i=0; i<LATENCY_BUCKETS; i++) {
+		counts[i] = hc_latency[i];
+		total += counts[i];
+		if (clear) {
+			hc_latency[i] = 0;
+		}
+	}
+	max = hc_maxlatency;
+	if (clear) {
+		hc_maxlatency = 0;
+	}
+	splx(spl);
+
+	kprintf("Timer interrupt latency (%u interrupts, max %u usec):\n",
+		total, max);
+	for (last = LATENCY_BUCKETS-1; last > 0 && counts[last]==0; last--);
+	for (i=0; i<=last; i++) {
+		if (i == LATENCY_BUCKETS-1) {
+			kprintf("    >= %7u usec: %u\n", 1U << (i-1), counts[i]);
+		}
+		else {
+			kprintf("    <  %7u usec: %u\n", 1U << i, counts[i]);
+		}
+	}
+}
+
+/*
+ * Work out how many ticks have passed since the last hardclock. This
+ * is one when the timer is going off every tick; when it has been
+ * stretched (or restarted part way), it's whatever the clock says,
+ * with the leftover fraction of a tick kept for next time.
+ */
+static
+unsigned
+hardclock_elapsed(struct ltimer_softc *lt)
+{
+	time_t secs;
+	u_int32_t nsecs, ns;
+	unsigned nticks;
+
+	ltimer_gettime(lt, &secs, &nsecs);
+	hardclock_latency(secs, nsecs);
+	if (hardclock_nsecs(hc_lastsecs, hc_lastnsecs, secs, nsecs, &ns)) {
+		/* Way off (or the clock was set); call it a second. */
+		ns = HZ * TICK_NSECS;
+	}
+	hc_lastsecs = secs;
+	hc_lastnsecs = nsecs;
+
+	ns += hc_carry;
+	nticks = ns / TICK_NSECS;
+	if (nticks == 0) {
+		/* Came in a hair early. */
+		nticks = 1;
+		hc_carry = 0;
+	}
+	else {
+		hc_carry = ns % TICK_NSECS;
+	}
+	return nticks;
+}
+
 /*
  * Interrupt handler.
  */
@@ -74,7 +291,7 @@ ltimer_irq(void *vlt)
 		 * (Any additional timer devices are unused.)
 		 */
 		if (lt->lt_hardclock) {
-			hardclock();
+			hardclock(hardclock_elapsed(lt));
 		}
 	}
 }
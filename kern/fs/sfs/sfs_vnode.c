@@ -14,12 +14,17 @@
 #include <uio.h>
 #include <dev.h>
 #include <sfs.h>
+#include <objcache.h>
+#include <machine/spl.h>
 
 /* At bottom of file */
 static int 
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
 
+/* Vnode structures come from here; made by the first sfs_loadvnode. */
+static struct objcache *sfs_vnode_objcache;
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -866,17 +871,17 @@ sfs_reclaim(struct vnode *v)
 	 * decision was made to reclaim it. (You must also synchronize
 	 * this with sfs_loadvnode.)
 	 */
-	lock_acquire(v->vn_countlock);
+	mutex_acquire(v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
 		assert(v->vn_refcount>1);
 		v->vn_refcount--;
 
-		lock_release(v->vn_countlock);
+		mutex_release(v->vn_countlock);
 		return EBUSY;
 	}
-	lock_release(v->vn_countlock);
+	mutex_release(v->vn_countlock);
 	
 
 	/* If there are no on-disk references to the file either, erase it. */
@@ -917,7 +922,7 @@ sfs_reclaim(struct vnode *v)
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	objcache_free(sfs_vnode_objcache, sv);
 
 	/* Done */
 	return 0;
@@ -1550,7 +1555,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops = NULL;
 	int i, num;
-	int result;
+	int result, spl;
 
 	/* Look in the vnodes table */
 	num = array_getnum(sfs->sfs_vnodes);
@@ -1579,7 +1584,18 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	spl = splhigh();
+	if (sfs_vnode_objcache == NULL) {
+		sfs_vnode_objcache = objcache_create("sfs_vnode",
+						     sizeof(struct sfs_vnode),
+						     NULL);
+	}
+	splx(spl);
+	if (sfs_vnode_objcache == NULL) {
+		return ENOMEM;
+	}
+
+	sv = objcache_alloc(sfs_vnode_objcache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1593,7 +1609,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		objcache_free(sfs_vnode_objcache, sv);
 		return result;
 	}
 
@@ -1630,7 +1646,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		objcache_free(sfs_vnode_objcache, sv);
 		return result;
 	}
 
@@ -1641,7 +1657,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	result = array_add(sfs->sfs_vnodes, sv);
 	if (result) {
 		VOP_KILL(&sv->sv_v);
-		kfree(sv);
+		objcache_free(sfs_vnode_objcache, sv);
 		return result;
 	}
 
@@ -52,7 +52,7 @@ struct knowndev {
 };
 
 static struct array *knowndevs;
-static struct lock *knowndevs_lock;
+static struct rwlock *knowndevs_lock;
 
 /*
  * Setup function
@@ -64,7 +64,7 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
-	knowndevs_lock = lock_create("knowndevs");
+	knowndevs_lock = rwlock_create("knowndevs");
 	if (knowndevs_lock==NULL) {
 		panic("vfs: Could not create knowndevs lock\n");
 	}
@@ -82,7 +82,7 @@ vfs_sync(void)
 	struct knowndev *dev;
 	int i, num;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -92,7 +92,7 @@ vfs_sync(void)
 		}
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return 0;
 }
@@ -108,7 +108,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	int i, num;
 	int err=0;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -179,7 +179,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	err = ENODEV;
 
  out:
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return err;
 }
@@ -195,14 +195,14 @@ vfs_getdevname(struct fs *fs)
 
 	assert(fs != NULL);
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = array_getguy(knowndevs, i);
 
 		if (kd->kd_fs == fs) {
-			lock_release(knowndevs_lock);
+			rwlock_release_read(knowndevs_lock);
 			/*
 			 * This is not a race condition: as long as the
 			 * guy calling us holds a reference to the fs,
@@ -213,7 +213,7 @@ vfs_getdevname(struct fs *fs)
 		}
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return NULL;
 }
@@ -275,7 +275,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	int i, num;
 	struct knowndev *kd;
 
-	assert(lock_do_i_hold(knowndevs_lock));
+	assert(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -345,7 +345,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 
 	if (!badnames(name, rawname, volname)) {
 		err = array_add(knowndevs, kd);
@@ -354,7 +354,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		err = EEXIST;
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 
 	return err;
 
@@ -401,7 +401,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold knowndevs_lock for writing.
  */
 static
 int
@@ -410,7 +410,7 @@ findmount(const char *devname, struct knowndev **result)
 	struct knowndev *dev;
 	int i, num, found=0;
 
-	assert(lock_do_i_hold(knowndevs_lock));
+	assert(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = array_getnum(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -445,7 +445,7 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 	
 
 	result = findmount(devname, &kd);
@@ -476,7 +476,7 @@ vfs_mount(const char *devname, void *data,
 	assert(result==0);
 	
  puke:
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -490,7 +490,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 	
 
 	result = findmount(devname, &kd);
@@ -523,7 +523,7 @@ vfs_unmount(const char *devname)
 	assert(result==0);
 
  puke:
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -536,7 +536,7 @@ vfs_unmountall(void)
 	struct knowndev *dev;
 	int i, num, result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -583,7 +583,7 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 
 	return 0;
 }
@@ -21,7 +21,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	vn->vn_opencount = 0;
-	vn->vn_countlock = lock_create("vnode-countlock");
+	vn->vn_countlock = mutex_create("vnode-countlock");
 	if (vn->vn_countlock == NULL) {
 		return ENOMEM;
 	}
@@ -41,7 +41,7 @@ vnode_kill(struct vnode *vn)
 	assert(vn->vn_opencount==0);
 	assert(vn->vn_countlock!=NULL);
 
-	lock_destroy(vn->vn_countlock);
+	mutex_destroy(vn->vn_countlock);
 
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
@@ -60,9 +60,9 @@ void
 vnode_incref(struct vnode *vn)
 {
 	assert(vn!=NULL);
-	lock_acquire(vn->vn_countlock);
+	mutex_acquire(vn->vn_countlock);
 	vn->vn_refcount++;
-	lock_release(vn->vn_countlock);
+	mutex_release(vn->vn_countlock);
 }
 
 /*
@@ -77,7 +77,7 @@ vnode_decref(struct vnode *vn)
 
 	assert(vn!=NULL);
 
-	lock_acquire(vn->vn_countlock);
+	mutex_acquire(vn->vn_countlock);
 	assert(vn->vn_refcount>0);
 	if (vn->vn_refcount>1) {
 		vn->vn_refcount--;
@@ -85,7 +85,7 @@ vnode_decref(struct vnode *vn)
 	else {
 		actually_do_it = 1;
 	}
-	lock_release(vn->vn_countlock);
+	mutex_release(vn->vn_countlock);
 
 	if (actually_do_it) {
 		result = VOP_RECLAIM(vn);
@@ -105,9 +105,9 @@ void
 vnode_incopen(struct vnode *vn)
 {
 	assert(vn!=NULL);
-	lock_acquire(vn->vn_countlock);
+	mutex_acquire(vn->vn_countlock);
 	vn->vn_opencount++;
-	lock_release(vn->vn_countlock);
+	mutex_release(vn->vn_countlock);
 }
 
 /*
@@ -120,11 +120,11 @@ vnode_decopen(struct vnode *vn)
 	int opencount, result;
 
 	assert(vn!=NULL);
-	lock_acquire(vn->vn_countlock);
+	mutex_acquire(vn->vn_countlock);
 	assert(vn->vn_opencount>0);
 	vn->vn_opencount--;
 	opencount = vn->vn_opencount;
-	lock_release(vn->vn_countlock);
+	mutex_release(vn->vn_countlock);
 
 	if (opencount > 0) {
 		return;
@@ -173,7 +173,7 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	lock_acquire(v->vn_countlock);
+	mutex_acquire(v->vn_countlock);
 
 	if (v->vn_refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
@@ -196,5 +196,5 @@ vnode_check(struct vnode *v, const char *opstr)
 			opstr, v->vn_opencount);
 	}
 
-	lock_release(v->vn_countlock);
+	mutex_release(v->vn_countlock);
 }
@@ -15,13 +15,72 @@ struct vnode;
  */
 
 #if OPT_A3
-struct pte
-{
-	vaddr_t vaddr;
-	paddr_t paddr;
-	int flags;
-	int valid;
-};
+/*
+ * Two-level page table.
+ *
+ * A user virtual address is split into a 10-bit directory index, a
+ * 10-bit leaf index and the 12-bit page offset. The directory holds
+ * pointers to leaf pages, each of which is one page of packed page
+ * table entries. Leaves are only allocated for the parts of the
+ * address space that have a region defined in them.
+ *
+ * A page table entry is a single word: the physical frame in the
+ * PAGE_FRAME bits and the flags below in the low bits. An entry of 0
+ * means the page is not part of the address space at all; an entry
+ * with permission bits but without PTE_VALID is a defined page that
+ * has no frame yet. A page that has been evicted keeps its swap slot
+ * number in the frame bits and has PTE_SWAPPED set instead.
+ *
+ * Until a page without file contents is first written, reads of it
+ * are served from a shared zero page that vm_fault maps read-only; the
+ * entry itself stays without a frame, so fork just copies it.
+ *
+ * After fork, parent and child entries point at the same frames. The
+ * coremap counts the sharers; while a frame is shared, it is only
+ * entered in the TLB read-only, and a write fault copies it.
+ *
+ * Pages of an executable's segments start out with PTE_FILE and no
+ * frame. The first fault reads them from the executable's vnode, which
+ * the address space keeps a reference to, along with where in the file
+ * each segment's contents are.
+ *
+ * PTE_BUSY marks an entry whose page is in the middle of being moved
+ * to or from swap (or copied by as_copy). Anyone else who needs the
+ * entry sleeps on its address until the flag is cleared.
+ */
+typedef u_int32_t pte_t;
+
+#define PT_DIR_SHIFT    22
+#define PT_LEAF_SHIFT   12
+#define PT_LEAF_ENTRIES (PAGE_SIZE / sizeof(pte_t))
+#define PT_DIR_ENTRIES  (USERTOP >> PT_DIR_SHIFT)
+
+#define PT_DIR_INDEX(va)  ((va) >> PT_DIR_SHIFT)
+#define PT_LEAF_INDEX(va) (((va) >> PT_LEAF_SHIFT) & (PT_LEAF_ENTRIES - 1))
+
+/* Permission bits (same values as the ELF PF_X/PF_W/PF_R flags) */
+#define PTE_EXEC        0x001
+#define PTE_WRITE       0x002
+#define PTE_READ        0x004
+#define PTE_PERMS       (PTE_READ | PTE_WRITE | PTE_EXEC)
+/* A physical frame is attached to the entry */
+#define PTE_VALID       0x008
+/* The page lives in the swap slot held in the frame bits */
+#define PTE_SWAPPED     0x010
+/* Page is in transit; sleep on the entry and look again */
+#define PTE_BUSY        0x020
+/* Page has never been touched and comes from the executable */
+#define PTE_FILE        0x040
+/* Loaded into the TLB since the TLB clock hand last passed */
+#define PTE_REF         0x080
+/* Loaded into the TLB since the page replacement policy last looked */
+#define PTE_ACCESSED    0x100
+
+#define PTE_FRAME(pte)  ((pte) & PAGE_FRAME)
+#define PTE_FLAGS(pte)  ((pte) & ~PAGE_FRAME)
+#define PTE_SLOT(pte)   ((pte) >> PT_LEAF_SHIFT)
+#define MKPTE_SLOT(slot, flags) \
+	(((slot) << PT_LEAF_SHIFT) | (((flags) & ~PTE_VALID) | PTE_SWAPPED))
 #endif
 
 struct addrspace {
@@ -36,14 +95,26 @@ struct addrspace {
 #else
 	#if OPT_A3
 	vaddr_t as_vbase1;
-	paddr_t as_pbase1;
 	size_t as_npages1;
 	vaddr_t as_vbase2;
-	paddr_t as_pbase2;
 	size_t as_npages2;
-	paddr_t as_stackpbase;
 
-	struct array * pt;
+	vaddr_t as_heapbase;	/* start of the heap (page aligned) */
+	vaddr_t as_heaptop;	/* current break */
+
+	pte_t **as_pt;		/* page directory, PT_DIR_ENTRIES leaves */
+
+	u_int32_t as_asid;	/* TLB address space ID... */
+	u_int32_t as_asid_gen;	/* ...valid if this is the current generation */
+
+	/* File contents of the two regions, for demand loading */
+	struct vnode *as_file;	/* executable, or NULL */
+	vaddr_t as_fvaddr1;	/* where the contents start (unaligned) */
+	off_t as_foffset1;	/* ...and where they are in the file */
+	size_t as_fsize1;
+	vaddr_t as_fvaddr2;
+	off_t as_foffset2;
+	size_t as_fsize2;
 	#endif
 #endif
 };
@@ -96,6 +167,44 @@ int		  as_prepare_load(struct addrspace *as);
 int		  as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if OPT_A3
+/*
+ *    as_lookup_pte - return a pointer to the page table entry for VADDR,
+ *                or NULL if there is no leaf covering it. If CREATE is
+ *                set, a missing leaf is allocated (NULL is then only
+ *                returned on out-of-memory).
+ */
+pte_t            *as_lookup_pte(struct addrspace *as, vaddr_t vaddr,
+				int create);
+
+/*
+ *    as_define_file - note that the FILESIZE bytes at VADDR, which must
+ *                lie in a region already defined, are at OFFSET in the
+ *                executable V. They are read in by vm_fault when first
+ *                touched. The address space holds a reference to V.
+ *
+ *    as_load_page - fill the frame at PADDR with whatever parts of the
+ *                file contents of the page at VADDR there are, zeroing
+ *                the rest. May sleep.
+ */
+int               as_define_file(struct addrspace *as, struct vnode *v,
+				 off_t offset, vaddr_t vaddr, size_t filesize);
+int               as_load_page(struct addrspace *as, vaddr_t vaddr,
+			       paddr_t paddr);
+
+/*
+ *    as_sbrk   - move the break of the heap (which starts right after
+ *                the regions loaded from the executable) by AMOUNT
+ *                bytes and hand back the old one. Pages above the new
+ *                break are released; new pages get frames on first
+ *                touch. ENOMEM if the heap would run into the stack or
+ *                outgrow memory plus swap, EINVAL if it would shrink
+ *                below its start.
+ */
+int               as_sbrk(struct addrspace *as, int amount,
+			  vaddr_t *oldbreak);
+#endif
+
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
@@ -6,7 +6,22 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called from the timer interrupt HZ times a second.
+ * hardclock() is called from the timer interrupt, normally HZ times a
+ * second. NTICKS is the number of 1/HZ ticks that have gone by since
+ * the last call, which is more than one when the timer has been
+ * stretched out.
+ *
+ * hardclock_tickless() is called by the scheduler with ON set when
+ * there is no other thread to switch to, so the timer need only go off
+ * when something is due (the next lbolt), and with ON clear when
+ * there is one again.
+ *
+ * hardclock_setinterval() is supplied by the timer device driving
+ * hardclock; it makes the timer go off every NTICKS ticks from now.
+ * hardclock_gettime() reads that timer's clock, and gives zero before
+ * there is one.
+ * hardclock_printlatency() prints how late the timer interrupts have
+ * been handled, and clears the record if CLEAR is set.
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
  */
@@ -27,7 +42,30 @@
 #define HZ  100
 #endif
 
-void hardclock(void);
+extern volatile u_int32_t hardclock_ticks;	/* ticks since boot */
+extern volatile u_int32_t hardclock_idleticks;	/* ...with nothing running */
+
+/*
+ * CPU usage of a thread, or the threads of a process put together.
+ * Ticks are counted by hardclock; the times are read off the timer's
+ * clock at each context switch and wakeup, so they also catch the
+ * parts of a tick a thread ran for.
+ */
+struct cpuusage {
+	u_int32_t cu_ticks;		/* clock ticks spent running */
+	unsigned cu_nvcsw;		/* voluntary context switches */
+	unsigned cu_nivcsw;		/* involuntary ones (preemptions) */
+	time_t cu_runsecs;		/* time spent running */
+	u_int32_t cu_runnsecs;
+	time_t cu_sleepsecs;		/* time spent asleep */
+	u_int32_t cu_sleepnsecs;
+};
+
+void hardclock(unsigned nticks);
+void hardclock_tickless(int on);
+void hardclock_setinterval(unsigned nticks);
+void hardclock_gettime(time_t *secs, u_int32_t *nsecs);
+void hardclock_printlatency(int clear);
 
 void gettime(time_t *seconds, u_int32_t *nanoseconds);
 
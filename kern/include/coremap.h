@@ -1,22 +1,111 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
 #include <types.h>
 #include <vm.h>
 #include "opt-A3.h"
 #if OPT_A3
 
-// Structs
+/*
+ * Coremap: one entry per physical frame managed by the VM system.
+ *
+ * The map is a single flat array stolen from the bottom of physical
+ * memory at boot, before the kernel heap exists. Frame N of the map
+ * lives at physical address coremap_base + N * PAGE_SIZE, so going
+ * from a physical address to its entry is a subtraction and a shift.
+ *
+ * Free frames are kept in power-of-two blocks on per-order free lists
+ * (a buddy allocator). Single-page requests pop the order-0 list;
+ * larger requests split the smallest block that fits and hand the
+ * unused tail straight back, so no memory is lost to rounding.
+ *
+ * Frames holding user pages record the address space and virtual page
+ * they back. When memory runs out, such frames are evicted to swap:
+ * synchronously by getuserpage(), or ahead of time by the page-out
+ * daemon, which keeps the number of free frames above a low
+ * watermark so that kernel allocations (which cannot sleep) succeed.
+ *
+ * After fork, parent and child share user frames copy-on-write; the
+ * entry counts the page table entries pointing at the frame. A shared
+ * frame is never evicted. Its owner (cm_as) is whichever sharer still
+ * had it when it became shared, or NULL once that one lets go; the
+ * last sharer takes it back over on its next fault.
+ *
+ * Which page to evict is up to the replacement policy (fifo, clock or
+ * aging), chosen with the "pagepolicy" menu command. All of them work
+ * from the list of resident user frames in page-in order and from
+ * the accessed bits vm_fault leaves in page table entries.
+ */
+
+struct addrspace;
+
+#define CM_MAX_ORDER	10	/* largest free block: 2^10 pages (4M) */
+
+/* Values for cm_state */
+#define CM_FREE		0	/* head of a free block */
+#define CM_USED		1	/* head of an allocated block */
+#define CM_INNER	2	/* non-head frame of a block */
+
+/* Bits in cm_flags */
+#define CM_PINNED	0x01	/* being filled or emptied; don't evict */
+#define CM_RESIDENT	0x02	/* user frame, on the resident list */
+
 struct coremap_entry {
-	paddr_t paddr;
-	int used;
-	int block_len;
+	struct addrspace *cm_as;	/* owner of a user frame, or NULL */
+	vaddr_t cm_vaddr;		/* user page held in the frame */
+	int cm_next;		/* free list links (frame numbers, -1 ends) */
+	int cm_prev;
+	u_int16_t cm_npages;	/* pages in the block this entry heads */
+	u_int16_t cm_refcount;	/* page table entries using a user frame */
+	u_int8_t cm_order;	/* buddy order, for free blocks */
+	u_int8_t cm_age;	/* aging policy's reference history */
+	u_int8_t cm_state;
+	u_int8_t cm_flags;
 };
 
-static struct coremap_entry **coremap;
-static int coremap_size;
-static volatile int coremap_ready = 0;
-
 // Methods
-void initialize_coremap();
+void initialize_coremap(void);
 paddr_t getppages(unsigned long npages);
 void releasepages(paddr_t paddr);
+int coremap_nframes(void);
+
+/*
+ * getuserpage - get a frame for user page VADDR of address space AS,
+ *               evicting another user page if memory is full. The
+ *               frame comes back pinned; call coremap_unpin once the
+ *               page table entry points at it. Returns 0 if no frame
+ *               could be found. May sleep; interrupts must be off.
+ *
+ * coremap_share - add a reference to user frame PADDR (fork).
+ *
+ * coremap_unshare - drop AS's reference to user frame PADDR, freeing
+ *               the frame when it was the last one.
+ *
+ * coremap_private - return 1 if AS holds the only reference to user
+ *               frame PADDR (making AS and VADDR its owner again), or
+ *               0 if the frame is still shared copy-on-write.
+ *
+ * pageout_bootstrap - start the page-out daemon (needs swap).
+ *
+ * coremap_set_policy - choose the replacement policy by name; EINVAL
+ *               if there's no such policy.
+ *
+ * coremap_count_fault - count a page fault for the policy's stats;
+ *               RESIDENT is set if the page was in memory, clear if
+ *               it had to be read back from swap.
+ *
+ * coremap_printstats - print the policy stats.
+ */
+paddr_t getuserpage(struct addrspace *as, vaddr_t vaddr);
+void coremap_unpin(paddr_t paddr);
+void coremap_share(paddr_t paddr);
+void coremap_unshare(paddr_t paddr, struct addrspace *as);
+int coremap_private(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void pageout_bootstrap(void);
+int coremap_set_policy(const char *name);
+const char *coremap_policy_name(void);
+void coremap_count_fault(int resident);
+void coremap_printstats(void);
 
-#endif
+#endif /* OPT_A3 */
+#endif /* _COREMAP_H_ */
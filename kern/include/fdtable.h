@@ -32,6 +32,9 @@ int fdtable_open(char *name, int flags, int *retfd);
 // Closes a file and removes it from the table
 int fdtable_close(int fd);
 
+// Sets up the allocator for table entries; call once at boot
+void fdtable_bootstrap();
+
 // Initializes the table for a new process
 int fdtable_create();
 
@@ -7,6 +7,7 @@
  */
 
 #include <machine/setjmp.h>
+#include "opt-kheaptags.h"
 
 /*
  * Tell GCC to check printf formats.
@@ -91,6 +92,22 @@ void *kmalloc(size_t sz);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Allocation tagging. With options kheaptags, each kmalloc is charged
+ * to the file and line it was called from. kheap_printtags lists the
+ * call sites holding the most memory. kheap_marktags notes the current
+ * point; kheap_printleaks then lists what was allocated since and is
+ * still live, by call site. Without the option these just say so.
+ */
+void kheap_printtags(void);
+void kheap_marktags(void);
+void kheap_printleaks(void);
+
+#if OPT_KHEAPTAGS
+void *kmalloc_tagged(size_t sz, const char *file, int line);
+#define kmalloc(sz) kmalloc_tagged(sz, __FILE__, __LINE__)
+#endif
+
 /*
  * C string functions. 
  *
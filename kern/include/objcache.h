@@ -0,0 +1,37 @@
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+/*
+ * Object caches: allocators for many objects of one fixed size.
+ *
+ * Objects are carved out of whole pages (slabs) got from alloc_kpages,
+ * packed at their own size (rounded up to 8) instead of the next
+ * power of two, as kmalloc would. Each slab keeps its free objects on
+ * a list, so allocating and freeing are constant time; the slab an
+ * object belongs to is found from its address. A cache keeps one
+ * completely free slab in hand and gives any others back.
+ *
+ * Functions:
+ *       objcache_create - make a cache of objects of SIZE bytes, which
+ *                         must fit in a page with the slab header.
+ *                         If CTOR is not NULL it is called on every
+ *                         object as it is handed out. Returns NULL if
+ *                         out of memory.
+ *       objcache_alloc  - get an object. Returns NULL if out of memory.
+ *       objcache_free   - give back an object got from the same cache.
+ *       objcache_printstats - print the counts of every cache.
+ *
+ * Caches are meant to last; there is no way to destroy one. All of
+ * these may be called with interrupts off, but not from an interrupt
+ * handler.
+ */
+
+struct objcache; /* Opaque. */
+
+struct objcache *objcache_create(const char *name, size_t size,
+				 void (*ctor)(void *));
+void            *objcache_alloc(struct objcache *);
+void             objcache_free(struct objcache *, void *ptr);
+void             objcache_printstats(void);
+
+#endif /* _OBJCACHE_H_ */
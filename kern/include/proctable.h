@@ -1,6 +1,7 @@
 #include <types.h>
 #include <synch.h>
 #include <fdtable.h>
+#include <clock.h>
 
 #include "opt-A2.h"
 
@@ -21,12 +22,21 @@ struct process
 	int status;
 	int exit_code;
 
+	// CPU share for the stride scheduler; inherited on fork
+	int tickets;
+
+	// CPU usage of the process's thread, added in when it exits
+	struct cpuusage usage;
+
 	struct fdtable *t_fdtable;
     struct lock *t_fdtable_lock;
     struct cv *waitpid_cv;
 };
 
 // Lock for the entire process table
+// (Held across exit and waitpid, whose CVs use it. The table's slots
+// are also guarded by a reader-writer lock inside proctable.c, so
+// lookups alone don't need it.)
 struct lock *proctable_lock;
 
 // Initialize the process table
@@ -48,4 +58,7 @@ int proctable_set_process_exited(pid_t pid, int exitcode);
 // Return NULL if process does not exist
 struct process* proctable_get_process(pid_t pid);
 
+// Print the CPU usage of processes that have exited but not been reaped
+void proctable_printusage();
+
 #endif /* OPT_A2 */
@@ -9,7 +9,23 @@
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
  *
- *     print_run_queue - dump the run queue to the console for debugging.
+ *     scheduler_tick - charge the current thread for NTICKS clock ticks.
+ *                     Returns nonzero if it should give up the processor.
+ *     scheduler_yield - note that thread T is giving up the processor
+ *                     voluntarily (it gets a fresh quantum).
+ *
+ *     scheduler_set_quantum - set the top level's quantum, in clock
+ *                     ticks. Returns an error code.
+ *     scheduler_get_quantum - return it.
+ *
+ *     scheduler_set_policy - choose the scheduler by name: "mlfq" (the
+ *                     default) or "stride". EINVAL if there's no such one.
+ *     scheduler_policy_name - name of the current one.
+ *     scheduler_set_tickets - give thread T a share of TICKETS for the
+ *                     stride scheduler (1 to SCHED_MAXTICKETS).
+ *
+ *     print_run_queue - dump the run queues and scheduler statistics to
+ *                     the console for debugging.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
@@ -20,8 +36,19 @@
 
 struct thread;
 
+/* Stride scheduler shares. */
+#define SCHED_DEFTICKETS	100
+#define SCHED_MAXTICKETS	1000
+
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
+int scheduler_tick(unsigned nticks);
+void scheduler_yield(struct thread *t);
+int scheduler_set_quantum(int ticks);
+int scheduler_get_quantum(void);
+int scheduler_set_policy(const char *name);
+const char *scheduler_policy_name(void);
+void scheduler_set_tickets(struct thread *t, int tickets);
 
 void print_run_queue(void);
 
@@ -0,0 +1,39 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <types.h>
+#include "opt-A3.h"
+#if OPT_A3
+
+/*
+ * Swap area on a raw disk device.
+ *
+ * The swap device is divided into page-sized slots, tracked with a
+ * bitmap. Evicted pages are written to a slot and their page table
+ * entry records the slot number instead of a frame.
+ *
+ *    swap_bootstrap - open the swap device and size the slot bitmap.
+ *                     Swapping is simply left off if there's no disk.
+ *    swap_enabled   - true if there is a usable swap device.
+ *    swap_size      - number of slots (0 without swap).
+ *    swap_alloc     - reserve a free slot. Returns ENOSPC when full.
+ *    swap_free      - release a slot.
+ *    swap_in        - read slot SLOT into the frame at PADDR.
+ *    swap_out       - write the frame at PADDR to slot SLOT.
+ *
+ * All but swap_bootstrap expect interrupts to be off. swap_in and
+ * swap_out sleep while the disk works.
+ */
+
+#define SWAP_DEVICE "lhd1raw:"
+
+void swap_bootstrap(void);
+int  swap_enabled(void);
+u_int32_t swap_size(void);
+int  swap_alloc(u_int32_t *slot);
+void swap_free(u_int32_t slot);
+int  swap_in(u_int32_t slot, paddr_t paddr);
+int  swap_out(u_int32_t slot, paddr_t paddr);
+
+#endif /* OPT_A3 */
+#endif /* _SWAP_H_ */
@@ -31,6 +31,70 @@ void              V(struct semaphore *);
 void              sem_destroy(struct semaphore *);
 
 
+/*
+ * Spinlock.
+ * Operations:
+ *    spinlock_init    - Set up a spinlock (which is usually embedded in
+ *                       some other structure, so it is not allocated).
+ *    spinlock_acquire - Turn interrupts off and take the lock, spinning
+ *                       until it is free.
+ *    spinlock_release - Drop the lock and restore the interrupt level
+ *                       it was taken at.
+ *    spinlock_do_i_hold - Return true if the current thread holds it.
+ *
+ * For short critical sections that must not sleep, and that may be
+ * entered from interrupt handlers. The holder may not sleep or take
+ * a spinlock it already holds. The spl saved by spinlock_acquire is
+ * kept in the lock, so spinlocks must be released in the reverse of
+ * the order they were taken.
+ *
+ * With only one CPU, a spinlock that is held by someone else when we
+ * get here can never be released (its holder can't run while
+ * interrupts are off), so that is treated as a deadlock and panics.
+ */
+
+struct spinlock {
+	volatile int sl_locked;
+	const void *sl_holder;		/* thread holding it */
+	int sl_spl;			/* spl to go back to on release */
+};
+
+void spinlock_init(struct spinlock *);
+void spinlock_acquire(struct spinlock *);
+void spinlock_release(struct spinlock *);
+int  spinlock_do_i_hold(struct spinlock *);
+
+
+/*
+ * Adaptive mutex.
+ * Operations:
+ *    mutex_acquire - Get the mutex. If it is held, poll it for a short
+ *                    while with interrupts on, then go to sleep.
+ *    mutex_release - Free the mutex, waking a sleeper if there is one.
+ *    mutex_do_i_hold - Return true if the current thread holds it.
+ *
+ * Meant for short critical sections that take too long to run with
+ * interrupts off. Unlike a lock, there is no handoff: a woken waiter
+ * competes for the mutex again, and a thread that spins may get it
+ * first. Holding a mutex across a sleep is allowed.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct mutex {
+	char *name;
+	const void * volatile mtx_owner;
+	volatile int mtx_waiters;	/* threads asleep on it */
+};
+
+struct mutex *mutex_create(const char *name);
+void          mutex_acquire(struct mutex *);
+void          mutex_release(struct mutex *);
+int           mutex_do_i_hold(struct mutex *);
+void          mutex_destroy(struct mutex *);
+
+
 /*
  * Simple lock for mutual exclusion.
  * Operations:
@@ -41,8 +105,16 @@ void              sem_destroy(struct semaphore *);
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
  *
+ *    lock_printstats - Print the contention counts of every lock that
+ *                   has been acquired, and how often mutexes had to
+ *                   spin or sleep.
+ *
  * These operations must be atomic. You get to write them.
  *
+ * Waiters queue up in FIFO order. lock_release hands the lock straight
+ * to the thread that has waited longest, so it can't be snatched by a
+ * newcomer before that thread gets to run.
+ *
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
@@ -54,9 +126,16 @@ struct lock {
 	char *name;
 	#if OPT_A1
 	const void * volatile owner;
+
+	/* Contention statistics */
+	unsigned acquires;	/* times acquired */
+	unsigned contended;	/* times a thread had to wait for it */
+	unsigned waitticks;	/* clock ticks spent waiting, in total */
+
+	/* List of all locks, for lock_printstats */
+	struct lock *next;
+	struct lock *prev;
 	#endif /* OPT_A1 */
-	// add what you need here
-	// (don't forget to mark things volatile as needed)
 };
 
 struct lock *lock_create(const char *name);
@@ -64,6 +143,7 @@ void         lock_acquire(struct lock *);
 void         lock_release(struct lock *);
 int          lock_do_i_hold(struct lock *);
 void         lock_destroy(struct lock *);
+void         lock_printstats(void);
 
 
 /*
@@ -88,14 +168,17 @@ void         lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
+ * Waiters are signalled in FIFO order. A signalled thread isn't woken
+ * (only to block again on the lock, which the signaller holds); it is
+ * moved to the back of the lock's queue and gets the lock handed to
+ * it in turn.
+ *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
 
 struct cv {
 	char *name;
-	// add what you need here
-	// (don't forget to mark things volatile as needed)
 };
 
 struct cv *cv_create(const char *name);
@@ -104,4 +187,43 @@ void       cv_signal(struct cv *cv, struct lock *lock);
 void       cv_broadcast(struct cv *cv, struct lock *lock);
 void       cv_destroy(struct cv *);
 
+
+/*
+ * Reader-writer lock.
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock in shared mode. Any number of
+ *                           threads can hold it shared at once.
+ *    rwlock_release_read  - Give up a shared hold.
+ *    rwlock_acquire_write - Get the lock in exclusive mode: no other
+ *                           thread holds it in either mode.
+ *    rwlock_release_write - Give up an exclusive hold. Only the thread
+ *                           holding it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock exclusively.
+ *
+ * Writers get preference: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers. (It
+ * follows that a thread must not take a shared hold it already has
+ * again.) When the last writer leaves, all waiting readers go in
+ * together.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+	char *name;
+	volatile int readers;		/* threads holding it shared */
+	volatile int writers_waiting;	/* threads waiting to write */
+	const void * volatile writer;	/* thread holding it exclusively */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void           rwlock_acquire_read(struct rwlock *);
+void           rwlock_release_read(struct rwlock *);
+void           rwlock_acquire_write(struct rwlock *);
+void           rwlock_release_write(struct rwlock *);
+int            rwlock_do_i_hold_write(struct rwlock *);
+void           rwlock_destroy(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
@@ -1,4 +1,5 @@
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
@@ -7,6 +8,8 @@
  * Prototypes for IN-KERNEL entry points for system call implementations.
  */
 
+struct trapframe;
+
 int sys_reboot(int code);
 #if OPT_A2
 int sys_open(userptr_t filename, int flags, int mode, int *retval);
@@ -18,6 +21,11 @@ int sys_fork(struct trapframe *tf, pid_t *retpid);
 int sys_waitpid(pid_t pid, u_int32_t *retstatus, int options, pid_t *retpid);
 int sys__exit(int exitcode);
 int sys_execv(userptr_t progname, userptr_t args);
+int sys_setshare(int tickets, int *retval);
 #endif /* OPT_A2 */
+#if OPT_A3
+int sys___vmstat(userptr_t counts, int ncounts, int *retval);
+int sys_sbrk(int amount, int *retval);
+#endif /* OPT_A3 */
 
 #endif /* _SYSCALL_H_ */
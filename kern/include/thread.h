@@ -9,6 +9,7 @@
 #include "opt-A2.h"
 
 #include <proctable.h>
+#include <clock.h>
 
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
@@ -16,6 +17,9 @@
 
 struct addrspace;
 
+/* Names shorter than this are kept in the thread itself. */
+#define THREAD_NAMELEN	16
+
 struct thread {
 	/**********************************************************/
 	/* Private thread members - internal to the thread system */
@@ -23,8 +27,22 @@ struct thread {
 	
 	struct pcb t_pcb;
 	char *t_name;
+	char t_namebuf[THREAD_NAMELEN];
 	const void *t_sleepaddr;
+	struct thread *t_sleepnext;	/* sleep queue links */
+	struct thread *t_sleepprev;
 	char *t_stack;
+	int t_priority;		/* scheduler run queue level, 0 = highest */
+	int t_ticks;		/* clock ticks used of the current quantum */
+	int t_tickets;		/* stride scheduler share */
+	u_int32_t t_pass;	/* stride scheduler pass value */
+	struct thread *t_allnext;	/* list of all live threads */
+	struct thread *t_allprev;
+
+	/* CPU accounting */
+	struct cpuusage t_usage;
+	time_t t_stampsecs;	/* when it last started running or slept */
+	u_int32_t t_stampnsecs;
 	
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
@@ -103,10 +121,18 @@ void thread_wakeup(const void *addr);
 
 #if OPT_A1
 /*
- * Cause only one thread sleeping on the specified address to wake up.
- * Interrupts must be disabled.
+ * Cause only one thread sleeping on the specified address to wake up:
+ * the one that has been asleep longest. Returns it, or NULL if there
+ * was none. Interrupts must be disabled.
+ */
+struct thread *thread_single_wakeup(const void *addr);
+
+/*
+ * Make the longest sleeper on address FROM sleep on address TO
+ * instead, behind any threads already sleeping there. Returns it, or
+ * NULL if there was none. Interrupts must be disabled.
  */
-void thread_single_wakeup(const void *addr);
+struct thread *thread_requeue(const void *from, const void *to);
 #endif
 /*
  * Return nonzero if there are any threads sleeping on the specified
@@ -139,6 +165,29 @@ int thread_hassleepers(const void *addr);
  */
 int one_thread_only(void);
 
+/*
+ * Mark the current thread as a kernel daemon: a service thread that
+ * runs for the life of the system. Daemons are not counted by
+ * one_thread_only(), so they don't keep the menu waiting forever.
+ */
+void thread_daemonize(void);
+
+/*
+ * Print the hit and miss counts of the caches of thread structures
+ * and stacks that thread_fork draws on.
+ */
+void thread_printstats(void);
+
+/*
+ * Add the CPU usage of the current thread so far to USAGE.
+ */
+void thread_addusage(struct cpuusage *usage);
+
+/*
+ * Print the live threads, busiest first, with their CPU usage.
+ */
+void thread_printusage(void);
+
 /*
  * Private thread functions.
  */
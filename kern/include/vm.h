@@ -26,6 +26,9 @@ void vm_bootstrap(void);
 
 #if OPT_A3
 void vm_shutdown(void);
+
+/* Upper bound on the pages a process may define (memory plus swap) */
+u_int32_t vm_maxpages(void);
 #endif /* OPT_A3 */
 
 /* Fault handling function called by trap code */
@@ -41,7 +41,14 @@
 #define VMSTAT_TLB_RELOAD             (4)
 #define VMSTAT_PAGE_FAULT_ZERO        (5)
 #define VMSTAT_PAGE_FAULT_DISK        (6)
-#define VMSTAT_COUNT                  (7)
+#define VMSTAT_PAGE_OUT               (7)
+#define VMSTAT_PAGE_OUT_DAEMON        (8)
+#define VMSTAT_COW_FAULT              (9)
+#define VMSTAT_ELF_FILE_READ          (10)
+#define VMSTAT_ASID_ALLOC             (11)
+#define VMSTAT_ASID_ROLLOVER          (12)
+#define VMSTAT_ZERO_PAGE_MAP          (13)
+#define VMSTAT_COUNT                  (14)
 
 /* ----------------------------------------------------------------------- */
 
@@ -0,0 +1,53 @@
+#ifndef _VMTLB_H_
+#define _VMTLB_H_
+
+#include <types.h>
+#include "opt-A3.h"
+#if OPT_A3
+
+/*
+ * TLB management for the A3 VM system.
+ *
+ * After a flush, misses fill the TLB in slot order. Once it is full,
+ * the replacement policy picks the slot to overwrite:
+ *
+ *    rr     - round robin over the 64 slots (the default).
+ *    random - let the processor pick one (TLB_Random).
+ *    clock  - second chance. vm_fault sets PTE_REF in the page table
+ *             whenever it loads a page into the TLB; the hand skips
+ *             (and clears) entries whose page has it set.
+ *
+ * The policy is chosen with the "tlbpolicy" menu command, normally
+ * given on the kernel command line.
+ *
+ * Entries are tagged with the address space ID of their address space,
+ * so switching address spaces doesn't need a flush. There are only 63
+ * ASIDs to go round; when they run out the TLB is flushed and they are
+ * handed out afresh.
+ *
+ *    tlb_set_policy      - select a policy by name. EINVAL if unknown.
+ *    tlb_policy_name     - name of the current policy.
+ *    tlb_activate        - make AS the address space the TLB translates
+ *                          for, giving it an ASID if it has none.
+ *    tlb_forget          - take away AS's ASID, which makes all its
+ *                          entries unreachable. (Done when it goes
+ *                          away, or to drop all its entries at once.)
+ *    tlb_load            - enter VADDR -> PADDR, writable or not, for
+ *                          the active address space, replacing any
+ *                          entry already there for VADDR.
+ *    tlb_invalidate_page - invalidate AS's entry for VADDR, if any.
+ *
+ * All but tlb_set_policy and tlb_policy_name expect interrupts off.
+ */
+
+struct addrspace;
+
+int         tlb_set_policy(const char *name);
+const char *tlb_policy_name(void);
+void        tlb_activate(struct addrspace *as);
+void        tlb_forget(struct addrspace *as);
+void        tlb_load(vaddr_t vaddr, paddr_t paddr, int writable);
+void        tlb_invalidate_page(struct addrspace *as, vaddr_t vaddr);
+
+#endif /* OPT_A3 */
+#endif /* _VMTLB_H_ */
@@ -0,0 +1,62 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: work deferred to kernel worker threads.
+ *
+ * A work item is a function and the two arguments to call it with.
+ * Items are normally embedded in whatever structure they work on, so
+ * posting one never allocates memory or sleeps, and may be done from
+ * an interrupt handler. Posting an item that is still queued does
+ * nothing, so the function runs once for any number of posts made
+ * before it starts. Items run in the order they were posted, on the
+ * first free worker, with interrupts on; they may sleep.
+ *
+ *     workqueue_create - make a queue served by NWORKERS new threads.
+ *                        The workers are daemons and run until
+ *                        shutdown. Returns NULL if out of memory.
+ *     work_init        - set up a work item to call FUNC.
+ *     workqueue_post   - queue item W on WQ. Returns nonzero if it was
+ *                        queued, zero if it already was.
+ *     workqueue_printstats - print the post and run counts of every
+ *                        queue.
+ *
+ *     workqueue_bootstrap - start sys_workq, the general-purpose queue.
+ *                        Must come after thread_bootstrap.
+ */
+
+struct work {
+	void (*w_func)(void *, unsigned long);
+	void *w_data1;
+	unsigned long w_data2;
+	struct work *w_next;
+	int w_queued;
+};
+
+struct workqueue {
+	char *wq_name;
+	struct work *wq_head;
+	struct work *wq_tail;
+	int wq_len;
+	int wq_nworkers;
+
+	/* Statistics */
+	unsigned wq_posts;	/* items posted (not counting repeats) */
+	unsigned wq_runs;	/* items run */
+	int wq_maxlen;		/* longest the queue has been */
+
+	struct workqueue *wq_next;	/* list of all queues */
+};
+
+extern struct workqueue *sys_workq;
+
+struct workqueue *workqueue_create(const char *name, int nworkers);
+void              work_init(struct work *w,
+			    void (*func)(void *, unsigned long),
+			    void *data1, unsigned long data2);
+int               workqueue_post(struct workqueue *wq, struct work *w);
+void              workqueue_printstats(void);
+
+void workqueue_bootstrap(void);
+
+#endif /* _WORKQUEUE_H_ */
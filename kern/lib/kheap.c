@@ -3,6 +3,9 @@
 #include <vm.h>
 #include <machine/spl.h>
 
+/* The real kmalloc is defined here; lib.h may have renamed it. */
+#undef kmalloc
+
 static
 void
 fill_deadbeef(void *vptr, size_t len)
@@ -41,6 +44,14 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    So that kfree can get from a pointer to its page's entry without
+//    looking at every page, the entries are also hashed on page
+//    number. Heap pages come from a small stretch of memory, so the
+//    low bits of the page number spread them evenly over the buckets.
+//    The table starts small, in the BSS, and is doubled (in pages from
+//    alloc_kpages) whenever there get to be more pages than buckets,
+//    so the chains stay short however big the heap gets.
+//
 
 #undef  SLOW	/* consistency checks */
 #undef SLOWER	/* lots of consistency checks */
@@ -69,7 +80,8 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
+	struct pageref *next_samehash;
 	vaddr_t pageaddr_and_blocktype;
 	u_int16_t freelist_offset;
 	u_int16_t nfree;
@@ -84,73 +96,143 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
+ * Pagerefs come in page-sized chunks, NPAGEREFS to a page; each chunk
+ * lets us manage NPAGEREFS * 4k = 1M of kernel heap. The first chunk
+ * is in the kernel BSS, so the heap can start up without having to
+ * allocate anything; more are fetched with alloc_kpages as needed.
+ * Unused pagerefs are kept on a free list threaded through
+ * next_samesize.
  *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Chunks are never given back. Even a busy heap needs only a handful,
+ * and finding out when every pageref in a chunk is free again would
+ * cost more than the memory is worth.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
 static struct pageref pagerefs[NPAGEREFS];
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static int npagerefpages;	/* chunks, including the static one */
+
+/*
+ * Put the pagerefs of chunk PRS on the free list.
+ */
+static
+void
+addpagerefs(struct pageref *prs)
+{
+	unsigned i;
+
+	for (i=0; i<NPAGEREFS; i++) {
+		prs[i].next_samesize = freepagerefs;
+		freepagerefs = &prs[i];
+	}
+	npagerefpages++;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pageref *pr;
+	vaddr_t page;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
+	if (npagerefpages == 0) {
+		addpagerefs(pagerefs);
+	}
+
+	if (freepagerefs == NULL) {
+		page = alloc_kpages(1);
+		if (page == 0) {
+			/* ran out */
+			return NULL;
 		}
-		assert(0);
+		addpagerefs((struct pageref *)page);
 	}
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_samesize;
+	pr->next_samesize = NULL;
+	return pr;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	u_int32_t k;
-
-	j = p-pagerefs;
-	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	p->pageaddr_and_blocktype = 0;
+	p->next_samesize = freepagerefs;
+	freepagerefs = p;
 }
 
 ////////////////////////////////////////
 
+/*
+ * For each block size, the pages that have free blocks, so kmalloc
+ * can take the first. Pages leave the list when they fill up and
+ * come back when a block on them is freed.
+ */
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+#define NPAGEHASH0 64	/* buckets in the initial table */
+static struct pageref *pagehash0[NPAGEHASH0];
+
+static struct pageref **pagehash = pagehash0;
+static unsigned npagehash = NPAGEHASH0;	/* always a power of two */
+static unsigned npagehashed;		/* pages in the table */
+
+#define PAGEHASH(va) (((va) / PAGE_SIZE) & (npagehash - 1))
+
+/*
+ * Size of the next bigger hash table. Once out of the BSS, don't
+ * bother with less than a page.
+ */
+static
+unsigned
+pagehash_nextsize(void)
+{
+	unsigned n = npagehash * 2;
+
+	if (n < PAGE_SIZE / sizeof(struct pageref *)) {
+		n = PAGE_SIZE / sizeof(struct pageref *);
+	}
+	return n;
+}
+
+/*
+ * Move everything over to the table NEWHASH with NEWSIZE buckets.
+ * Returns the old table if it should be given back, or 0.
+ */
+static
+vaddr_t
+pagehash_grow(vaddr_t newhash, unsigned newsize)
+{
+	struct pageref **oldhash = pagehash;
+	struct pageref *pr;
+	unsigned oldsize = npagehash;
+	unsigned i;
+
+	assert(curspl>0);
+
+	pagehash = (struct pageref **)newhash;
+	npagehash = newsize;
+	for (i=0; i<newsize; i++) {
+		pagehash[i] = NULL;
+	}
+
+	for (i=0; i<oldsize; i++) {
+		while ((pr = oldhash[i]) != NULL) {
+			oldhash[i] = pr->next_samehash;
+			pr->next_samehash = pagehash[PAGEHASH(PR_PAGEADDR(pr))];
+			pagehash[PAGEHASH(PR_PAGEADDR(pr))] = pr;
+		}
+	}
+
+	if (oldhash == pagehash0) {
+		return 0;
+	}
+	return (vaddr_t)oldhash;
+}
 
 ////////////////////////////////////////
 
@@ -208,25 +290,35 @@ checksubpages(void)
 {
 	struct pageref *pr;
 	int i;
-	unsigned sc=0, ac=0;
+	unsigned sc=0, ac=0, hc=0;
 
 	assert(curspl>0);
 
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			assert(sc < NPAGEREFS);
+			assert(pr->nfree > 0);
+			assert(PR_BLOCKTYPE(pr) == (unsigned)i);
+			assert(sc < npagerefpages * NPAGEREFS);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		assert(ac < NPAGEREFS);
-		ac++;
+	/* Every page with free blocks should be on a list. */
+	for (i=0; i<(int)npagehash; i++) {
+		for (pr = pagehash[i]; pr != NULL; pr = pr->next_samehash) {
+			checksubpage(pr);
+			assert(PAGEHASH(PR_PAGEADDR(pr)) == (unsigned)i);
+			assert(ac < npagerefpages * NPAGEREFS);
+			if (pr->nfree > 0) {
+				ac++;
+			}
+			hc++;
+		}
 	}
 
 	assert(sc==ac);
+	assert(hc==npagehashed);
 }
 #else
 #define checksubpages() 
@@ -289,14 +381,21 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	int i;
 
 	/* print the whole thing with interrupts off */
 	int spl = splhigh();
 
-	kprintf("Subpage allocator status:\n");
+	kprintf("Subpage allocator status (%d page%s of pagerefs):\n",
+		npagerefpages, npagerefpages == 1 ? "" : "s");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	kprintf("%u page%s in a %u-bucket hash table\n",
+		npagehashed, npagehashed == 1 ? "" : "s", npagehash);
+
+	for (i=0; i<(int)npagehash; i++) {
+		for (pr = pagehash[i]; pr != NULL; pr = pr->next_samehash) {
+			dumpsubpage(pr);
+		}
 	}
 
 	splx(spl);
@@ -306,24 +405,45 @@ kheap_printstats(void)
 
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+add_samesize(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
-
-	assert(blktype>=0 && blktype<NSIZES);
+	pr->prev_samesize = NULL;
+	pr->next_samesize = sizebases[blktype];
+	if (sizebases[blktype] != NULL) {
+		sizebases[blktype]->prev_samesize = pr;
+	}
+	sizebases[blktype] = pr;
+}
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+static
+void
+remove_samesize(struct pageref *pr, int blktype)
+{
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
 	}
+	else {
+		assert(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+	pr->next_samesize = pr->prev_samesize = NULL;
+}
+
+static
+void
+remove_samehash(struct pageref *pr)
+{
+	struct pageref **guy;
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
+	for (guy = &pagehash[PAGEHASH(PR_PAGEADDR(pr))]; *guy;
+	     guy = &(*guy)->next_samehash) {
 		checksubpage(*guy);
 		if (*guy == pr) {
-			*guy = pr->next_all;
+			*guy = pr->next_samehash;
+			npagehashed--;
 			break;
 		}
 	}
@@ -347,6 +467,46 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Get a page for blocks of type BLKTYPE and fill in its free list.
+ * This is done with interrupts on: nobody else can see the page yet.
+ * Returns 0 if out of memory.
+ */
+static
+vaddr_t
+subpage_newpage(unsigned blktype)
+{
+	vaddr_t prpage;		// the page
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	volatile int i;
+	int nfree;
+
+	prpage = alloc_kpages(1);
+	if (prpage==0) {
+		return 0;
+	}
+
+	nfree = PAGE_SIZE / sizes[blktype];
+
+	/*
+	 * Note: fl is volatile because the MIPS toolchain we were
+	 * using in spring 2001 attempted to optimize this loop and
+	 * blew it. Making fl volatile inhibits the optimization.
+	 */
+
+	fla = prpage;
+	fl = (struct freelist *)fla;
+	fl->next = NULL;
+	for (i=1; i<nfree; i++) {
+		fl = (struct freelist *)(fla + i*sizes[blktype]);
+		fl->next = (struct freelist *)(fla + (i-1)*sizes[blktype]);
+		assert(fl != fl->next);
+	}
+
+	return prpage;
+}
+
 static
 void *
 subpage_kmalloc(size_t sz)
@@ -356,107 +516,142 @@ subpage_kmalloc(size_t sz)
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
-
-	volatile int i;
-
+	vaddr_t newpage;	// fresh page, if we needed one
+	vaddr_t prchunk;	// fresh pageref chunk, if we needed one
+	vaddr_t newhash;	// bigger hash table, if we needed one
+	unsigned newhashsize;	// ...and its number of buckets
 
 	blktype = blocktype(sz);
 	sz = sizes[blktype];
+	prchunk = 0;
+	newhash = 0;
 
 	spl = splhigh();
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	pr = sizebases[blktype];
+	if (pr == NULL) {
+		/*
+		 * No page of the right size available. Make a new one
+		 * with interrupts back on, then put it in place; if
+		 * someone else made one meanwhile, the list just gets
+		 * both.
+		 */
+		splx(spl);
 
-		/* check for corruption */
-		assert(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
+		newpage = subpage_newpage(blktype);
+		if (newpage==0) {
+			/* Out of memory. */
+			kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
+			return NULL;
+		}
 
-		if (pr->nfree > 0) {
+		/*
+		 * Likewise fetch more pagerefs now if they look to be
+		 * running out, rather than in allocpageref at splhigh.
+		 * Peeking at freepagerefs without the spl is only a hint.
+		 */
+		if (npagerefpages > 0 && freepagerefs == NULL) {
+			prchunk = alloc_kpages(1);
+		}
 
-		doalloc: /* comes here after getting a whole fresh page */
+		/* And a bigger hash table, if this page will need one. */
+		newhashsize = pagehash_nextsize();
+		if (npagehashed >= npagehash) {
+			newhash = alloc_kpages(DIVROUNDUP(newhashsize *
+				sizeof(struct pageref *), PAGE_SIZE));
+		}
 
-			assert(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+		spl = splhigh();
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		if (prchunk != 0 && freepagerefs == NULL) {
+			addpagerefs((struct pageref *)prchunk);
+			prchunk = 0;
+		}
 
-			if (fl != NULL) {
-				assert(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				assert(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
+		pr = allocpageref();
+		if (pr==NULL) {
+			/* Couldn't allocate accounting space for the new page. */
+			splx(spl);
+			free_kpages(newpage);
+			if (prchunk != 0) {
+				free_kpages(prchunk);
 			}
-			else {
-				assert(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
+			if (newhash != 0) {
+				free_kpages(newhash);
 			}
-
-			checksubpages();
-
-			splx(spl);
-			return retptr;
+			kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+			return NULL;
 		}
-	}
 
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 */
-
-	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
-		splx(spl);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		pr->pageaddr_and_blocktype = MKPAB(newpage, blktype);
+		pr->nfree = PAGE_SIZE / sizes[blktype];
+		pr->freelist_offset = (pr->nfree-1)*sizes[blktype];
+
+		add_samesize(pr, blktype);
+
+		pr->next_samehash = pagehash[PAGEHASH(newpage)];
+		pagehash[PAGEHASH(newpage)] = pr;
+		npagehashed++;
+
+		/*
+		 * Grow the table if it's (still) over one page per bucket.
+		 * If we can't, the chains just get a bit longer for now.
+		 * Either way, whichever table is left over goes back
+		 * after the splx.
+		 */
+		if (newhash != 0 && npagehashed > npagehash &&
+		    newhashsize > npagehash) {
+			newhash = pagehash_grow(newhash, newhashsize);
+		}
 	}
 
-	prpage = alloc_kpages(1);
-	if (prpage==0) {
-		/* Out of memory. */
-		freepageref(pr);
-		splx(spl);
-		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
-		return NULL;
-	}
+	/* check for corruption */
+	assert(PR_BLOCKTYPE(pr) == blktype);
+	assert(pr->nfree > 0);
+	checksubpage(pr);
 
-	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	assert(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-	/*
-	 * Note: fl is volatile because the MIPS toolchain we were
-	 * using in spring 2001 attempted to optimize this loop and
-	 * blew it. Making fl volatile inhibits the optimization.
-	 */
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-	fla = prpage;
-	fl = (struct freelist *)fla;
-	fl->next = NULL;
-	for (i=1; i<pr->nfree; i++) {
-		fl = (struct freelist *)(fla + i*sizes[blktype]);
-		fl->next = (struct freelist *)(fla + (i-1)*sizes[blktype]);
-		assert(fl != fl->next);
+	if (fl != NULL) {
+		assert(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		assert(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		/* Page is full; take it off the list. */
+		assert(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		remove_samesize(pr, blktype);
 	}
-	fla = (vaddr_t) fl;
-	pr->freelist_offset = fla - prpage;
-	assert(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	checksubpages();
 
-	pr->next_all = allbase;
-	allbase = pr;
+	splx(spl);
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	if (prchunk != 0) {
+		/*
+		 * Someone else refilled the pagerefs first. Only give the
+		 * chunk back now: dropping the spl any earlier would let
+		 * others empty (or even free) the page we just listed.
+		 */
+		free_kpages(prchunk);
+	}
+	if (newhash != 0) {
+		free_kpages(newhash);
+	}
+	return retptr;
 }
 
 static
@@ -478,15 +673,13 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
+	prpage = ptraddr & PAGE_FRAME;
+	for (pr = pagehash[PAGEHASH(prpage)]; pr; pr = pr->next_samehash) {
 		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
+		assert(PR_BLOCKTYPE(pr) < NSIZES);
 		checksubpage(pr);
 
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+		if (PR_PAGEADDR(pr) == prpage) {
 			break;
 		}
 	}
@@ -497,6 +690,7 @@ subpage_kfree(void *ptr)
 		return -1;
 	}
 
+	blktype = PR_BLOCKTYPE(pr);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -506,9 +700,12 @@ subpage_kfree(void *ptr)
 
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
+	 * uses of dangling pointers. The block is still allocated, so
+	 * its page (and PR) can't go away; do this with interrupts on.
 	 */
+	splx(spl);
 	fill_deadbeef(ptr, sizes[blktype]);
+	spl = splhigh();
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -518,7 +715,9 @@ subpage_kfree(void *ptr)
 	fla = prpage + offset;
 	fl = (struct freelist *)fla;
 	if (pr->freelist_offset == INVALID_OFFSET) {
+		/* Page was full; it has room again. */
 		fl->next = NULL;
+		add_samesize(pr, blktype);
 	} else {
 		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
 	}
@@ -527,10 +726,14 @@ subpage_kfree(void *ptr)
 
 	assert(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		free_kpages(prpage);
+		/* Whole page is free; give it back once interrupts are on. */
+		remove_samesize(pr, blktype);
+		remove_samehash(pr);
 		freepageref(pr);
+		checksubpages();
+		splx(spl);
+		free_kpages(prpage);
+		return 0;
 	}
 
 	checksubpages();
@@ -539,6 +742,358 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Allocation tagging (options kheaptags).
+//
+// lib.h turns every kmalloc call into kmalloc_tagged with the file
+// and line it came from. Each call site gets a tag counting its live
+// bytes, peak bytes and allocations, and each live block gets a record
+// naming its tag, so kfree can charge the block back. The records are
+// hashed on address and come a page at a time from alloc_kpages, like
+// the pagerefs, so tagging doesn't go through the heap it is watching.
+//
+// Records are also numbered in order of allocation. kheap_marktags
+// remembers the current number, and kheap_printleaks goes through the
+// records made after it to see what has not been freed since.
+//
+
+#if OPT_KHEAPTAGS
+
+struct ktag {
+	const char *kt_file;		/* call site; NULL if slot unused */
+	int kt_line;
+	u_int32_t kt_live;		/* bytes allocated and not freed */
+	u_int32_t kt_peak;		/* most kt_live has been */
+	u_int32_t kt_nlive;		/* blocks allocated and not freed */
+	u_int32_t kt_nallocs;		/* kmalloc calls, ever */
+	u_int32_t kt_leaked;		/* bytes live since the mark */
+	u_int32_t kt_nleaked;		/* blocks live since the mark */
+};
+
+struct kblock {
+	struct kblock *kb_next;		/* hash chain, or free list */
+	vaddr_t kb_addr;
+	u_int32_t kb_size;
+	u_int32_t kb_serial;		/* order of allocation */
+	struct ktag *kb_tag;
+};
+
+#define NKTAGS		256	/* call sites we can tell apart */
+#define NKBHASH		256
+#define NKBLOCKS	(PAGE_SIZE / sizeof(struct kblock))
+#define KTAGS_TOP	16	/* how many tags to print */
+
+/* Page-aligned blocks would all land in one bucket on the low bits. */
+#define KBHASH(va)	((((va) >> 4) ^ ((va) / PAGE_SIZE)) % NKBHASH)
+
+static struct ktag ktags[NKTAGS];
+static struct ktag ktag_other = { "(other call sites)", 0, 0, 0, 0, 0, 0, 0 };
+static struct kblock *kbhash[NKBHASH];
+static struct kblock *freekblocks;
+static int nkblockpages;
+static u_int32_t kb_serial;		/* last serial number handed out */
+static u_int32_t kb_mark;		/* serial number at the mark */
+static u_int32_t kb_untracked;		/* allocations we had no record for */
+
+/*
+ * Find the tag for FILE and LINE, making it if need be. When the table
+ * is full, new call sites share one catch-all tag.
+ */
+static
+struct ktag *
+ktag_find(const char *file, int line)
+{
+	unsigned i, h;
+
+	assert(curspl>0);
+
+	h = ((vaddr_t)file + line) % NKTAGS;
+	for (i=0; i<NKTAGS; i++) {
+		struct ktag *kt = &ktags[(h+i) % NKTAGS];
+		if (kt->kt_file == NULL) {
+			kt->kt_file = file;
+			kt->kt_line = line;
+			return kt;
+		}
+		if (kt->kt_file == file && kt->kt_line == line) {
+			return kt;
+		}
+	}
+	return &ktag_other;
+}
+
+/*
+ * Put the records in page PAGE on the free list.
+ */
+static
+void
+addkblocks(vaddr_t page)
+{
+	struct kblock *kbs = (struct kblock *)page;
+	unsigned i;
+
+	for (i=0; i<NKBLOCKS; i++) {
+		kbs[i].kb_next = freekblocks;
+		freekblocks = &kbs[i];
+	}
+	nkblockpages++;
+}
+
+void *
+kmalloc_tagged(size_t sz, const char *file, int line)
+{
+	void *ptr;
+	vaddr_t page;
+	struct ktag *kt;
+	struct kblock *kb;
+	int spl;
+
+	ptr = kmalloc(sz);
+	if (ptr == NULL) {
+		return NULL;
+	}
+
+	/* Get more records with interrupts on, if they look to be short. */
+	page = 0;
+	if (freekblocks == NULL) {
+		page = alloc_kpages(1);
+	}
+
+	spl = splhigh();
+
+	if (page != 0 && freekblocks == NULL) {
+		addkblocks(page);
+		page = 0;
+	}
+
+	kt = ktag_find(file, line);
+	kt->kt_nallocs++;
+
+	kb = freekblocks;
+	if (kb == NULL) {
+		/* Can't follow this one; kfree won't find it either. */
+		kb_untracked++;
+	}
+	else {
+		freekblocks = kb->kb_next;
+		kb->kb_addr = (vaddr_t)ptr;
+		kb->kb_size = sz;
+		kb->kb_serial = ++kb_serial;
+		kb->kb_tag = kt;
+		kb->kb_next = kbhash[KBHASH(kb->kb_addr)];
+		kbhash[KBHASH(kb->kb_addr)] = kb;
+
+		kt->kt_nlive++;
+		kt->kt_live += sz;
+		if (kt->kt_live > kt->kt_peak) {
+			kt->kt_peak = kt->kt_live;
+		}
+	}
+
+	splx(spl);
+
+	if (page != 0) {
+		/* Someone else got more records first. */
+		free_kpages(page);
+	}
+	return ptr;
+}
+
+/*
+ * Called by kfree: uncharge PTR from its tag.
+ */
+static
+void
+ktag_release(void *ptr)
+{
+	struct kblock **kbp, *kb;
+	struct ktag *kt;
+	int spl;
+
+	spl = splhigh();
+	for (kbp = &kbhash[KBHASH((vaddr_t)ptr)]; *kbp != NULL;
+	     kbp = &(*kbp)->kb_next) {
+		kb = *kbp;
+		if (kb->kb_addr == (vaddr_t)ptr) {
+			*kbp = kb->kb_next;
+
+			kt = kb->kb_tag;
+			assert(kt->kt_nlive > 0 && kt->kt_live >= kb->kb_size);
+			kt->kt_nlive--;
+			kt->kt_live -= kb->kb_size;
+
+			kb->kb_next = freekblocks;
+			freekblocks = kb;
+			break;
+		}
+	}
+	splx(spl);
+}
+
+/*
+ * Copy the (up to) NTOP tags with the most live bytes, or the most
+ * bytes leaked since the mark if LEAKS is set, into TOP, biggest
+ * first. Returns how many there were.
+ */
+static
+int
+ktag_top(struct ktag *top, int ntop, int leaks)
+{
+	struct ktag *kt;
+	u_int32_t key;
+	int i, j, n = 0;
+
+	assert(curspl>0);
+
+	for (i=0; i<=NKTAGS; i++) {
+		kt = (i < NKTAGS) ? &ktags[i] : &ktag_other;
+		key = leaks ? kt->kt_leaked : kt->kt_live;
+		if (kt->kt_file == NULL || key == 0) {
+			continue;
+		}
+		for (j=n; j>0; j--) {
+			if ((leaks ? top[j-1].kt_leaked : top[j-1].kt_live)
+			    >= key) {
+				break;
+			}
+			if (j < ntop) {
+				top[j] = top[j-1];
+			}
+		}
+		if (j < ntop) {
+			top[j] = *kt;
+			if (n < ntop) {
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+/*
+ * __FILE__ is relative to the compile directory; skip the ../../
+ */
+static
+const char *
+ktag_filename(const char *file)
+{
+	while (file[0]=='.' && file[1]=='.' && file[2]=='/') {
+		file += 3;
+	}
+	return file;
+}
+
+void
+kheap_printtags(void)
+{
+	struct ktag top[KTAGS_TOP];
+	u_int32_t live = 0, nlive = 0, untracked;
+	int i, n, spl;
+
+	spl = splhigh();
+	for (i=0; i<NKTAGS; i++) {
+		live += ktags[i].kt_live;
+		nlive += ktags[i].kt_nlive;
+	}
+	live += ktag_other.kt_live;
+	nlive += ktag_other.kt_nlive;
+	untracked = kb_untracked;
+	n = ktag_top(top, KTAGS_TOP, 0);
+	splx(spl);
+
+	kprintf("Kernel heap: %u bytes live in %u blocks", live, nlive);
+	if (untracked > 0) {
+		kprintf(" (%u allocations untracked)", untracked);
+	}
+	kprintf("\n");
+	kprintf("%-36s %9s %9s %7s %9s\n",
+		"call site", "live", "peak", "blocks", "allocs");
+	for (i=0; i<n; i++) {
+		kprintf("%30s:%-5d %9u %9u %7u %9u\n",
+			ktag_filename(top[i].kt_file), top[i].kt_line,
+			top[i].kt_live, top[i].kt_peak,
+			top[i].kt_nlive, top[i].kt_nallocs);
+	}
+}
+
+void
+kheap_marktags(void)
+{
+	int spl;
+
+	spl = splhigh();
+	kb_mark = kb_serial;
+	splx(spl);
+
+	kprintf("Kernel heap: marked at allocation %u\n", kb_mark);
+}
+
+void
+kheap_printleaks(void)
+{
+	struct ktag top[KTAGS_TOP];
+	struct kblock *kb;
+	u_int32_t leaked = 0, nleaked = 0;
+	int i, n, spl;
+
+	spl = splhigh();
+
+	for (i=0; i<NKTAGS; i++) {
+		ktags[i].kt_leaked = ktags[i].kt_nleaked = 0;
+	}
+	ktag_other.kt_leaked = ktag_other.kt_nleaked = 0;
+
+	for (i=0; i<NKBHASH; i++) {
+		for (kb = kbhash[i]; kb != NULL; kb = kb->kb_next) {
+			if (kb->kb_serial > kb_mark) {
+				kb->kb_tag->kt_leaked += kb->kb_size;
+				kb->kb_tag->kt_nleaked++;
+				leaked += kb->kb_size;
+				nleaked++;
+			}
+		}
+	}
+	n = ktag_top(top, KTAGS_TOP, 1);
+
+	splx(spl);
+
+	kprintf("Kernel heap: %u bytes in %u blocks allocated since the mark "
+		"and still live\n", leaked, nleaked);
+	if (n == 0) {
+		return;
+	}
+	kprintf("%-36s %9s %7s\n", "call site", "bytes", "blocks");
+	for (i=0; i<n; i++) {
+		kprintf("%30s:%-5d %9u %7u\n",
+			ktag_filename(top[i].kt_file), top[i].kt_line,
+			top[i].kt_leaked, top[i].kt_nleaked);
+	}
+}
+
+#else /* OPT_KHEAPTAGS */
+
+void
+kheap_printtags(void)
+{
+	kprintf("Kernel heap: allocation tagging not compiled in "
+		"(options kheaptags)\n");
+}
+
+void
+kheap_marktags(void)
+{
+	kheap_printtags();
+}
+
+void
+kheap_printleaks(void)
+{
+	kheap_printtags();
+}
+
+#endif /* OPT_KHEAPTAGS */
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -570,7 +1125,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KHEAPTAGS
+	ktag_release(ptr);
+#endif
+	if (subpage_kfree(ptr)) {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
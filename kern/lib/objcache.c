@@ -0,0 +1,273 @@
+/*
+ * Object caches. See objcache.h.
+ *
+ * Each slab is one page: a struct slab at the front, then as many
+ * objects as fit. A cache's slabs with free objects are on its
+ * partial list, slabs with none on its full list; a slab moves
+ * between them as objects come and go, and leaves both when it is
+ * completely free. Everything is done with interrupts off.
+ */
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <machine/spl.h>
+#include <objcache.h>
+
+#define OBJ_ALIGN	8
+
+/* Free objects are linked through their first word. */
+struct freeobj {
+	struct freeobj *next;
+};
+
+struct slab {
+	struct slab *sl_next;
+	struct slab *sl_prev;
+	struct objcache *sl_cache;
+	struct freeobj *sl_free;
+	unsigned sl_nfree;
+};
+
+#define SLAB_HDRSIZE	ROUNDUP(sizeof(struct slab), OBJ_ALIGN)
+
+struct objcache {
+	char *oc_name;
+	size_t oc_size;			/* object size, rounded up */
+	unsigned oc_perslab;		/* objects per slab */
+	void (*oc_ctor)(void *);
+
+	struct slab *oc_partial;	/* slabs with free objects */
+	struct slab *oc_full;		/* slabs without */
+	struct slab *oc_spare;		/* a free slab kept in hand */
+
+	/* Statistics */
+	unsigned oc_allocs;		/* objects allocated */
+	unsigned oc_frees;		/* objects freed */
+	unsigned oc_inuse;		/* objects allocated now */
+	unsigned oc_peak;		/* most ever allocated at once */
+	unsigned oc_slabs;		/* slabs held, including the spare */
+
+	struct objcache *oc_next;	/* list of all caches */
+};
+
+/* Every cache, for objcache_printstats. */
+static struct objcache *allcaches;
+
+static
+void
+slab_insert(struct slab **list, struct slab *sl)
+{
+	sl->sl_prev = NULL;
+	sl->sl_next = *list;
+	if (*list != NULL) {
+		(*list)->sl_prev = sl;
+	}
+	*list = sl;
+}
+
+static
+void
+slab_remove(struct slab **list, struct slab *sl)
+{
+	if (sl->sl_prev != NULL) {
+		sl->sl_prev->sl_next = sl->sl_next;
+	}
+	else {
+		*list = sl->sl_next;
+	}
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prev = sl->sl_prev;
+	}
+	sl->sl_next = sl->sl_prev = NULL;
+}
+
+/*
+ * Get a fresh slab for OC, with all its objects free.
+ */
+static
+struct slab *
+slab_create(struct objcache *oc)
+{
+	struct slab *sl;
+	struct freeobj *fo;
+	vaddr_t page, obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	sl = (struct slab *)page;
+	sl->sl_next = sl->sl_prev = NULL;
+	sl->sl_cache = oc;
+	sl->sl_free = NULL;
+	sl->sl_nfree = oc->oc_perslab;
+
+	/* Thread the list backwards, so objects go out in address order. */
+	obj = page + SLAB_HDRSIZE + (oc->oc_perslab - 1) * oc->oc_size;
+	for (i=0; i<oc->oc_perslab; i++) {
+		fo = (struct freeobj *)obj;
+		fo->next = sl->sl_free;
+		sl->sl_free = fo;
+		obj -= oc->oc_size;
+	}
+
+	oc->oc_slabs++;
+	return sl;
+}
+
+struct objcache *
+objcache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct objcache *oc;
+	int spl;
+
+	size = ROUNDUP(size, OBJ_ALIGN);
+	if (size < sizeof(struct freeobj)) {
+		size = ROUNDUP(sizeof(struct freeobj), OBJ_ALIGN);
+	}
+	assert(SLAB_HDRSIZE + size <= PAGE_SIZE);
+
+	oc = kmalloc(sizeof(struct objcache));
+	if (oc == NULL) {
+		return NULL;
+	}
+	oc->oc_name = kstrdup(name);
+	if (oc->oc_name == NULL) {
+		kfree(oc);
+		return NULL;
+	}
+
+	oc->oc_size = size;
+	oc->oc_perslab = (PAGE_SIZE - SLAB_HDRSIZE) / size;
+	oc->oc_ctor = ctor;
+	oc->oc_partial = oc->oc_full = oc->oc_spare = NULL;
+	oc->oc_allocs = oc->oc_frees = 0;
+	oc->oc_inuse = oc->oc_peak = 0;
+	oc->oc_slabs = 0;
+
+	spl = splhigh();
+	oc->oc_next = allcaches;
+	allcaches = oc;
+	splx(spl);
+
+	return oc;
+}
+
+void *
+objcache_alloc(struct objcache *oc)
+{
+	struct slab *sl;
+	struct freeobj *fo;
+	int spl;
+
+	spl = splhigh();
+
+	sl = oc->oc_partial;
+	if (sl == NULL) {
+		sl = oc->oc_spare;
+		if (sl != NULL) {
+			oc->oc_spare = NULL;
+		}
+		else {
+			sl = slab_create(oc);
+			if (sl == NULL) {
+				splx(spl);
+				return NULL;
+			}
+		}
+		slab_insert(&oc->oc_partial, sl);
+	}
+
+	assert(sl->sl_nfree > 0);
+	fo = sl->sl_free;
+	sl->sl_free = fo->next;
+	sl->sl_nfree--;
+	if (sl->sl_nfree == 0) {
+		slab_remove(&oc->oc_partial, sl);
+		slab_insert(&oc->oc_full, sl);
+	}
+
+	oc->oc_allocs++;
+	oc->oc_inuse++;
+	if (oc->oc_inuse > oc->oc_peak) {
+		oc->oc_peak = oc->oc_inuse;
+	}
+
+	splx(spl);
+
+	if (oc->oc_ctor != NULL) {
+		oc->oc_ctor(fo);
+	}
+	return fo;
+}
+
+void
+objcache_free(struct objcache *oc, void *ptr)
+{
+	struct slab *sl;
+	struct freeobj *fo = ptr;
+	vaddr_t offset;
+	int spl;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	sl = (struct slab *)((vaddr_t)ptr & PAGE_FRAME);
+	offset = (vaddr_t)ptr - (vaddr_t)sl;
+	if (sl->sl_cache != oc || offset < SLAB_HDRSIZE ||
+	    (offset - SLAB_HDRSIZE) % oc->oc_size != 0) {
+		panic("objcache_free: %s: invalid pointer %p\n",
+		      oc->oc_name, ptr);
+	}
+
+	spl = splhigh();
+
+	assert(sl->sl_nfree < oc->oc_perslab);
+	if (sl->sl_nfree == 0) {
+		slab_remove(&oc->oc_full, sl);
+		slab_insert(&oc->oc_partial, sl);
+	}
+	fo->next = sl->sl_free;
+	sl->sl_free = fo;
+	sl->sl_nfree++;
+
+	oc->oc_frees++;
+	oc->oc_inuse--;
+
+	if (sl->sl_nfree == oc->oc_perslab) {
+		slab_remove(&oc->oc_partial, sl);
+		if (oc->oc_spare == NULL) {
+			oc->oc_spare = sl;
+		}
+		else {
+			oc->oc_slabs--;
+			free_kpages((vaddr_t)sl);
+		}
+	}
+
+	splx(spl);
+}
+
+void
+objcache_printstats(void)
+{
+	struct objcache *oc;
+	int spl;
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kprintf("%-16s %5s %5s %6s %6s %6s %9s %9s\n", "objcache", "size",
+		"/slab", "slabs", "inuse", "peak", "allocs", "frees");
+	for (oc = allcaches; oc != NULL; oc = oc->oc_next) {
+		kprintf("%-16s %5u %5u %6u %6u %6u %9u %9u\n", oc->oc_name,
+			(unsigned)oc->oc_size, oc->oc_perslab, oc->oc_slabs,
+			oc->oc_inuse, oc->oc_peak, oc->oc_allocs,
+			oc->oc_frees);
+	}
+
+	splx(spl);
+}
@@ -11,6 +11,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <scheduler.h>
+#include <workqueue.h>
 #include <dev.h>
 #include <vfs.h>
 #include <vm.h>
@@ -76,23 +77,26 @@ boot(void)
 
 	ram_bootstrap();
 
+	#if OPT_A3
+	/* Must come before anything calls kmalloc. */
+	initialize_coremap();
+	#endif /* OPT_A3 */
+
 	scheduler_bootstrap();
 	
 	
 	#if OPT_A2
 	proctable_bootstrap();
+	fdtable_bootstrap();
 	#endif /* OPT_A2 */
 	
 	thread_bootstrap();
+	workqueue_bootstrap();
 	vfs_bootstrap();
 	dev_bootstrap();
 	vm_bootstrap();
 	kprintf_bootstrap();
 
-	#if OPT_A3
-	initialize_coremap();
-	#endif /* OPT_A3 */
-
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
         
@@ -9,6 +9,10 @@
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <synch.h>
+#include <scheduler.h>
+#include <workqueue.h>
+#include <objcache.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
@@ -18,6 +22,11 @@
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
+#if OPT_A3
+#include <vmtlb.h>
+#include <coremap.h>
+#endif
 
 #define _PATH_SHELL "/bin/sh"
 
@@ -353,6 +362,180 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+#if OPT_A3
+/*
+ * Command to choose the TLB replacement policy. Meant for the kernel
+ * command line, e.g. "tlbpolicy clock; p /testbin/tlbbench".
+ */
+static
+int
+cmd_tlbpolicy(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: tlbpolicy rr|random|clock\n");
+		kprintf("Current policy: %s\n", tlb_policy_name());
+		return EINVAL;
+	}
+
+	if (tlb_set_policy(args[1])) {
+		kprintf("Unknown TLB policy %s\n", args[1]);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Command to choose the page replacement policy, likewise.
+ */
+static
+int
+cmd_pagepolicy(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: pagepolicy fifo|clock|aging\n");
+		kprintf("Current policy: %s\n", coremap_policy_name());
+		return EINVAL;
+	}
+
+	if (coremap_set_policy(args[1])) {
+		kprintf("Unknown page replacement policy %s\n", args[1]);
+		return EINVAL;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Command to choose the scheduler. Meant for the kernel command line,
+ * e.g. "sched stride; p /testbin/stridebench".
+ */
+static
+int
+cmd_sched(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: sched mlfq|stride\n");
+		kprintf("Current scheduler: %s\n", scheduler_policy_name());
+		return EINVAL;
+	}
+
+	if (scheduler_set_policy(args[1])) {
+		kprintf("Unknown scheduler %s\n", args[1]);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Command to set the scheduler's time quantum, in clock ticks.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: quantum ticks\n");
+		kprintf("Current quantum: %d (%d ticks per second)\n",
+			scheduler_get_quantum(), HZ);
+		return EINVAL;
+	}
+
+	if (scheduler_set_quantum(atoi(args[1]))) {
+		kprintf("Bad quantum %s\n", args[1]);
+		return EINVAL;
+	}
+	return 0;
+}
+
+static
+int
+cmd_runqueue(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	print_run_queue();
+
+	return 0;
+}
+
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lock_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_workqueues(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	workqueue_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_top(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printusage();
+	#if OPT_A2
+	proctable_printusage();
+	#endif /* OPT_A2 */
+
+	return 0;
+}
+
+/*
+ * Kernel heap by call site. "kt mark" notes the current point and
+ * "kt diff" lists what has been allocated since and not freed; run a
+ * test in between to find what it leaks.
+ */
+static
+int
+cmd_kheaptags(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printtags();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "mark")) {
+		kheap_marktags();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "diff")) {
+		kheap_printleaks();
+	}
+	else {
+		kprintf("Usage: kt [mark | diff]\n");
+		return EINVAL;
+	}
+	return 0;
+}
+
+static
+int
+cmd_latency(int nargs, char **args)
+{
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "clear"))) {
+		kprintf("Usage: lat [clear]\n");
+		return EINVAL;
+	}
+
+	hardclock_printlatency(nargs == 2);
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -361,6 +544,8 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	objcache_printstats();
+	thread_printstats();
 	
 	return 0;
 }
@@ -404,6 +589,12 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if OPT_A3
+	"[tlbpolicy] TLB replacement policy  ",
+	"[pagepolicy] Page replacement policy",
+#endif
+	"[sched]   Choose scheduler          ",
+	"[quantum] Scheduler time quantum    ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -426,6 +617,7 @@ static const char *testmenu[] = {
 	"[qt]  Queue test                    ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kmalloc benchmark             ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -435,6 +627,7 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[rwt] RW lock test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
@@ -470,6 +663,12 @@ static const char *mainmenu[] = {
 	"[1b] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[kt] Heap by call site [mark|diff]  ",
+	"[top] Thread CPU usage              ",
+	"[lat] Interrupt latency [clear]     ",
+	"[rq] Run queues                     ",
+	"[locks] Lock contention stats       ",
+	"[wq] Work queue stats               ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -510,6 +709,12 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if OPT_A3
+	{ "tlbpolicy",	cmd_tlbpolicy },
+	{ "pagepolicy",	cmd_pagepolicy },
+#endif
+	{ "sched",	cmd_sched },
+	{ "quantum",	cmd_quantum },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -525,6 +730,12 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kt",		cmd_kheaptags },
+	{ "rq",		cmd_runqueue },
+	{ "locks",	cmd_lockstats },
+	{ "top",	cmd_top },
+	{ "lat",	cmd_latency },
+	{ "wq",		cmd_workqueues },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -532,6 +743,7 @@ static struct {
 	{ "qt",		queuetest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	mallocbench },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -543,6 +755,7 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "rwt",	rwtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
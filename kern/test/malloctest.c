@@ -6,6 +6,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <test.h>
+#include <clock.h>
 
 /*
  * Test kmalloc; allocate ITEMSIZE bytes NTRIES times, freeing
@@ -16,6 +17,14 @@
  *
  * mallocstress does the same thing, but from NTHREADS different
  * threads at once.
+ *
+ * mallocbench times kmalloc/kfree pairs of small blocks, first with
+ * the heap otherwise quiet and then with up to NBALLAST larger blocks
+ * (two to a page) held live, as many as memory allows, and reports
+ * pairs per second for both. That's thousands of heap pages, several
+ * to each bucket of the page hash if it didn't grow. The cost of kfree
+ * shouldn't depend on how many pages the heap has, so the two should
+ * come out about the same.
  */
 
 #define NTRIES   1200
@@ -108,3 +117,105 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+#define BENCHSIZE	32
+#define BENCHPAIRS	20000
+#define BALLASTSIZE	2000
+#define NBALLAST	8192
+
+static
+unsigned long
+benchpairs(void)
+{
+	time_t secs1, secs2, rsecs;
+	u_int32_t nsecs1, nsecs2, rnsecs;
+	unsigned long msecs;
+	void *ptr, *anchor;
+	int i;
+
+	/*
+	 * Hold one block throughout, so its page isn't handed back and
+	 * fetched again on every pair.
+	 */
+	anchor = kmalloc(BENCHSIZE);
+	if (anchor == NULL) {
+		kprintf("kmalloc returned null; test failed.\n");
+		return 0;
+	}
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<BENCHPAIRS; i++) {
+		ptr = kmalloc(BENCHSIZE);
+		if (ptr == NULL) {
+			kprintf("kmalloc returned null; test failed.\n");
+			kfree(anchor);
+			return 0;
+		}
+		kfree(ptr);
+	}
+	gettime(&secs2, &nsecs2);
+
+	kfree(anchor);
+
+	getinterval(secs1, nsecs1, secs2, nsecs2, &rsecs, &rnsecs);
+	msecs = rsecs * 1000 + rnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	return BENCHPAIRS * 1000UL / msecs;
+}
+
+int
+mallocbench(int nargs, char **args)
+{
+	void **ballast, *reserve;
+	unsigned long quiet, loaded;
+	int i, n;
+
+	(void)nargs;
+	(void)args;
+
+	ballast = kmalloc(NBALLAST * sizeof(void *));
+	if (ballast == NULL) {
+		kprintf("kmalloc returned null; test failed.\n");
+		return 0;
+	}
+
+	/*
+	 * The ballast may take all the memory there is; hold a block of
+	 * the benchmark size so there is still a page to time it on.
+	 */
+	reserve = kmalloc(BENCHSIZE);
+	if (reserve == NULL) {
+		kfree(ballast);
+		kprintf("kmalloc returned null; test failed.\n");
+		return 0;
+	}
+
+	kprintf("Starting kmalloc benchmark...\n");
+
+	quiet = benchpairs();
+
+	for (n=0; n<NBALLAST; n++) {
+		ballast[n] = kmalloc(BALLASTSIZE);
+		if (ballast[n] == NULL) {
+			break;
+		}
+	}
+
+	loaded = benchpairs();
+
+	for (i=0; i<n; i++) {
+		kfree(ballast[i]);
+	}
+	kfree(ballast);
+	kfree(reserve);
+
+	kprintf("%d-byte kmalloc/kfree pairs per second:\n", BENCHSIZE);
+	kprintf("    quiet heap:            %lu\n", quiet);
+	kprintf("    %d %d-byte blocks live: %lu\n", n, BALLASTSIZE,
+		loaded);
+	kprintf("kmalloc benchmark done\n");
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Reader-writer lock test code.
+ *
+ * Runs a crowd of readers on one rwlock for a while, first on their
+ * own and then with a writer taking the lock over and over, checking
+ * that readers and the writer never overlap. Reports how many read
+ * acquisitions per second the readers managed in each phase.
+ */
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+#include <clock.h>
+#include <machine/spl.h>
+
+#define NREADERS	8
+#define PHASESECS	2
+#define WRITEWORK	2000
+
+static struct rwlock *testrw;
+static struct semaphore *donesem;
+
+static volatile int stop;
+static volatile int readers_in;
+static volatile int writing;
+static volatile int failed;
+static volatile unsigned long nreads;
+static volatile unsigned long nwrites;
+
+static
+void
+inititems(void)
+{
+	if (testrw==NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	if (donesem==NULL) {
+		donesem = sem_create("donesem", 0);
+		if (donesem == NULL) {
+			panic("rwtest: sem_create failed\n");
+		}
+	}
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	failed = 1;
+}
+
+static
+void
+readerthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	int spl;
+
+	(void)junk;
+
+	while (!stop) {
+		rwlock_acquire_read(testrw);
+
+		spl = splhigh();
+		readers_in++;
+		splx(spl);
+
+		if (writing) {
+			rwfail(num, "reader got in while writing");
+		}
+		for (j=0; j<100; j++);
+		if (writing) {
+			rwfail(num, "writer got in while reading");
+		}
+
+		spl = splhigh();
+		readers_in--;
+		nreads++;
+		splx(spl);
+
+		rwlock_release_read(testrw);
+	}
+	V(donesem);
+}
+
+static
+void
+writerthread(void *junk, unsigned long num)
+{
+	volatile int j;
+
+	(void)junk;
+
+	while (!stop) {
+		rwlock_acquire_write(testrw);
+		if (readers_in != 0 || writing) {
+			rwfail(num, "writer got in with others inside");
+		}
+		writing = 1;
+		for (j=0; j<WRITEWORK; j++);
+		writing = 0;
+		nwrites++;
+		rwlock_release_write(testrw);
+
+		/* Give the readers a look in before trying again. */
+		thread_yield();
+	}
+	V(donesem);
+}
+
+/*
+ * Run NREADERS readers, plus a writer if WITHWRITER, for PHASESECS
+ * seconds. Returns the read acquisitions per second.
+ */
+static
+unsigned long
+runphase(int withwriter)
+{
+	time_t secs1, secs2, rsecs;
+	u_int32_t nsecs1, nsecs2, rnsecs;
+	unsigned long msecs;
+	int i, nthreads, result;
+
+	stop = 0;
+	nreads = 0;
+	nwrites = 0;
+
+	gettime(&secs1, &nsecs1);
+
+	nthreads = 0;
+	for (i=0; i<NREADERS; i++) {
+		result = thread_fork("rwtest reader", NULL, i, readerthread,
+				     NULL);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		nthreads++;
+	}
+	if (withwriter) {
+		result = thread_fork("rwtest writer", NULL, i, writerthread,
+				     NULL);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		nthreads++;
+	}
+
+	clocksleep(PHASESECS);
+	stop = 1;
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &rsecs, &rnsecs);
+	msecs = rsecs * 1000 + rnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	return nreads * 1000 / msecs;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned long alone, shared;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	failed = 0;
+
+	kprintf("Starting rwlock test...\n");
+
+	alone = runphase(0);
+	kprintf("%d readers alone: %lu reads/sec\n", NREADERS, alone);
+
+	shared = runphase(1);
+	kprintf("%d readers with a writer: %lu reads/sec, %lu writes\n",
+		NREADERS, shared, nwrites);
+
+	if (nwrites == 0) {
+		rwfail(NREADERS, "writer starved");
+	}
+
+	if (failed) {
+		kprintf("Rwlock test failed\n");
+	}
+	else {
+		kprintf("Rwlock test done.\n");
+	}
+	return 0;
+}
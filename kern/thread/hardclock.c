@@ -2,6 +2,8 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <thread.h>
+#include <curthread.h>
+#include <scheduler.h>
 #include <clock.h>
 
 /* 
@@ -11,25 +13,76 @@ int lbolt;
 
 static int lbolt_counter;
 
+/* Clock ticks since boot, and how many of them found nothing running. */
+volatile u_int32_t hardclock_ticks;
+volatile u_int32_t hardclock_idleticks;
+
+/* Set while the scheduler has nothing to switch to. */
+static int tickless;
+
+/* Ticks the timer is currently set to go off after. */
+static unsigned clock_interval = 1;
+
 /*
- * This is called HZ times a second by the timer device setup.
+ * Set the timer for the next thing due: every tick normally, or only
+ * at the next lbolt when tickless.
  */
+static
+void
+hardclock_program(void)
+{
+	unsigned nticks = tickless ? HZ - lbolt_counter : 1;
+
+	if (nticks != clock_interval) {
+		clock_interval = nticks;
+		hardclock_setinterval(nticks);
+	}
+}
 
 void
-hardclock(void)
+hardclock_tickless(int on)
+{
+	assert(curspl>0);
+
+	tickless = on;
+	hardclock_program();
+}
+
+/*
+ * This is called by the timer device setup, every tick unless the
+ * scheduler has switched the clock to tickless mode.
+ */
+
+void
+hardclock(unsigned nticks)
 {
 	/*
 	 * Collect statistics here as desired.
 	 */
 
+	hardclock_ticks += nticks;
 
-	lbolt_counter++;
+	/* Charge the ticks to whoever was running. */
+	if (curthread != NULL) {
+		curthread->t_usage.cu_ticks += nticks;
+	}
+	else {
+		hardclock_idleticks += nticks;
+	}
+
+	lbolt_counter += nticks;
 	if (lbolt_counter >= HZ) {
-		lbolt_counter = 0;
+		lbolt_counter %= HZ;
 		thread_wakeup(&lbolt);
 	}
 
-	thread_yield();
+	/* Switch only when the scheduler says the quantum is up. */
+	if (scheduler_tick(nticks)) {
+		thread_yield();
+	}
+	else {
+		hardclock_program();
+	}
 }
 
 /*
@@ -1,23 +1,104 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Multilevel feedback queue. There are SCHED_LEVELS round-robin run
+ * queues; the scheduler always runs the first thread of the highest
+ * (lowest numbered) nonempty one. Threads start at the top level.
+ *
+ *   - A thread that uses up its whole quantum drops a level. Quanta
+ *     double at each level down, so CPU hogs sink and then run in
+ *     longer, rarer slices.
+ *   - A thread that wakes up from thread_sleep rises a level and gets
+ *     a fresh quantum, so threads that mostly wait for the console or
+ *     the disk stay near the top.
+ *   - Once every SCHED_BOOST_TICKS ticks everybody goes back to the top,
+ *     so nothing starves behind a crowd of interactive threads.
+ *
+ * A thread that becomes runnable at a higher level than the current
+ * one preempts it on the next clock tick. A thread that gives up the
+ * processor of its own accord (thread_yield) starts its next turn with
+ * a fresh quantum.
+ *
+ * The top level's quantum is sched_quantum ticks (the "quantum" menu
+ * command). While there is no other thread to switch to, the clock is
+ * told to stop ticking until the next lbolt; the ticks that go by are
+ * charged all at once when it does go off.
+ *
+ * Alternatively ("sched stride" on the kernel command line) there is
+ * a stride scheduler, for proportional shares. Each thread holds some
+ * tickets (its process's share, set with the setshare system call)
+ * and has a pass value that advances by STRIDE1/tickets for every tick
+ * it runs; the runnable thread with the lowest pass goes next, for
+ * sched_quantum ticks. Threads that join the run queue (new, or woken
+ * up) start no further back than the last thread picked, so time spent
+ * asleep isn't saved up to hog the processor with later. The runnable
+ * threads are kept in a binary min-heap on pass, so adding one and
+ * picking the next are both O(log n). (A queued thread's pass never
+ * changes; only the running thread's does.)
  */
 
 #include <types.h>
 #include <lib.h>
+#include <kern/errno.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
+#include <clock.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include <array.h>
+
+#define SCHED_LEVELS		4
+#define SCHED_QUANTUM(level)	(sched_quantum << (level))
+#define SCHED_BOOST_TICKS	HZ
+
+#define SCHED_MLFQ		0
+#define SCHED_STRIDE		1
+
+#define STRIDE1			(1 << 20)
+#define STRIDE(t)		(STRIDE1 / (t)->t_tickets)
+
+/* Pass values wrap around; compare them like sequence numbers. */
+#define PASS_BEFORE(a, b)	((int)((a) - (b)) < 0)
+
+static const char *sched_policy_names[] = {
+	"mlfq",
+	"stride",
+	NULL
+};
+
+static int sched_policy = SCHED_MLFQ;
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+// Run queues, one per priority level
+static struct queue *runqueues[SCHED_LEVELS];
+
+// Stride scheduler's runnable threads, a min-heap on t_pass: the
+// children of slot i are slots 2i+1 and 2i+2
+static struct array *stridequeue;
+
+// Pass value of the thread last picked by the stride scheduler
+static u_int32_t stride_pass;
+
+// Quantum of the top level, in clock ticks
+static int sched_quantum = 1;
+
+// Ticks since the last anti-starvation boost
+static int boost_counter;
+
+// Statistics
+struct sched_levelstats {
+	unsigned ls_dispatches;	/* threads picked to run from this level */
+	unsigned ls_demotions;	/* threads dropped into this level */
+	unsigned ls_wakeboosts;	/* sleepers raised into this level */
+};
+static struct sched_levelstats levelstats[SCHED_LEVELS];
+static unsigned sched_preemptions;
+static unsigned sched_boosts;
+static unsigned sched_ticks;
 
 /*
  * Setup function
@@ -25,24 +106,38 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
+	int i;
+
+	for (i=0; i<SCHED_LEVELS; i++) {
+		runqueues[i] = q_create(32);
+		if (runqueues[i] == NULL) {
+			panic("scheduler: Could not create run queue\n");
+		}
+	}
+	stridequeue = array_create();
+	if (stridequeue == NULL) {
 		panic("scheduler: Could not create run queue\n");
 	}
 }
 
 /*
  * Ensure space for handling at least NTHREADS threads.
- * This is done only to ensure that make_runnable() does not fail -
- * if you change the scheduler to not require space outside the 
- * thread structure, for instance, this function can reasonably
- * do nothing.
+ * This is done only to ensure that make_runnable() does not fail.
+ * Any thread could end up on any level, so every queue needs room.
  */
 int
 scheduler_preallocate(int nthreads)
 {
+	int i, result;
+
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	for (i=0; i<SCHED_LEVELS; i++) {
+		result = q_preallocate(runqueues[i], nthreads);
+		if (result) {
+			return result;
+		}
+	}
+	return array_preallocate(stridequeue, nthreads);
 }
 
 /*
@@ -54,11 +149,21 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
+	for (i=0; i<SCHED_LEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
+	}
+	for (i=0; i<array_getnum(stridequeue); i++) {
+		struct thread *t = array_getguy(stridequeue, i);
 		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
 	}
+	/* Shrinking; cannot fail. */
+	array_setsize(stridequeue, 0);
 }
 
 /*
@@ -71,26 +176,140 @@ scheduler_killall(void)
 void
 scheduler_shutdown(void)
 {
+	int i;
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+	for (i=0; i<SCHED_LEVELS; i++) {
+		q_destroy(runqueues[i]);
+		runqueues[i] = NULL;
+	}
+	array_destroy(stridequeue);
+	stridequeue = NULL;
+}
+
+/*
+ * Return the highest level with a runnable thread, or SCHED_LEVELS if
+ * there is none.
+ */
+static
+int
+sched_toplevel(void)
+{
+	int i;
+
+	for (i=0; i<SCHED_LEVELS; i++) {
+		if (!q_empty(runqueues[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Return true if nothing is runnable (other than the current thread).
+ */
+static
+int
+sched_empty(void)
+{
+	if (sched_policy == SCHED_STRIDE) {
+		return array_getnum(stridequeue) == 0;
+	}
+	return sched_toplevel() == SCHED_LEVELS;
+}
+
+#define STRIDEGUY(i)	((struct thread *)array_getguy(stridequeue, (i)))
+
+/*
+ * Add T to the stride queue: put it at the bottom of the heap and move
+ * it up past any parents with a later pass.
+ */
+static
+int
+stride_add(struct thread *t)
+{
+	struct thread *parent;
+	int i, result;
+
+	result = array_add(stridequeue, t);
+	if (result) {
+		return result;
+	}
+
+	i = array_getnum(stridequeue) - 1;
+	while (i > 0) {
+		parent = STRIDEGUY((i-1)/2);
+		if (!PASS_BEFORE(t->t_pass, parent->t_pass)) {
+			break;
+		}
+		array_setguy(stridequeue, i, parent);
+		i = (i-1)/2;
+	}
+	array_setguy(stridequeue, i, t);
+	return 0;
+}
+
+/*
+ * Take the runnable thread with the lowest pass (the top of the heap)
+ * off the stride queue. The last thread fills the hole and is moved
+ * down past any children with an earlier pass.
+ */
+static
+struct thread *
+stride_next(void)
+{
+	struct thread *best, *last, *child;
+	int i, c, n;
+
+	n = array_getnum(stridequeue);
+	assert(n > 0);
+
+	best = STRIDEGUY(0);
+	last = STRIDEGUY(n-1);
+	/* Shrinking; cannot fail. */
+	array_setsize(stridequeue, --n);
+
+	i = 0;
+	while ((c = 2*i+1) < n) {
+		child = STRIDEGUY(c);
+		if (c+1 < n && PASS_BEFORE(STRIDEGUY(c+1)->t_pass,
+					   child->t_pass)) {
+			child = STRIDEGUY(++c);
+		}
+		if (!PASS_BEFORE(child->t_pass, last->t_pass)) {
+			break;
+		}
+		array_setguy(stridequeue, i, child);
+		i = c;
+	}
+	if (n > 0) {
+		array_setguy(stridequeue, i, last);
+	}
+
+	stride_pass = best->t_pass;
+	return best;
 }
 
 /*
  * Actual scheduler. Returns the next thread to run.  Calls cpu_idle()
  * if there's nothing ready. (Note: cpu_idle must be called in a loop
  * until something's ready - it doesn't know whether the things that
- * wake it up are going to make a thread runnable or not.) 
+ * wake it up are going to make a thread runnable or not.)
  */
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+	int level;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	while (q_empty(runqueue)) {
+
+	while (sched_empty()) {
+		/* Nothing to preempt; sleep until something is due. */
+		hardclock_tickless(1);
 		cpu_idle();
 	}
 
@@ -98,15 +317,30 @@ scheduler(void)
 	// doing - even this deep inside thread code, the console
 	// still works. However, the amount of text printed is
 	// prohibitive.
-	// 
+	//
 	//print_run_queue();
-	
-	return q_remhead(runqueue);
+
+	if (sched_policy == SCHED_STRIDE) {
+		t = stride_next();
+	}
+	else {
+		level = sched_toplevel();
+		levelstats[level].ls_dispatches++;
+		t = q_remhead(runqueues[level]);
+	}
+
+	/* Tick only while somebody else is waiting for the processor. */
+	hardclock_tickless(sched_empty());
+
+	return t;
 }
 
-/* 
- * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+/*
+ * Make a thread runnable, at the tail of its level's queue.
+ *
+ * A thread coming out of thread_sleep still has its sleep address
+ * set (thread_sleep clears it only once the thread runs again); such
+ * threads are moved up a level.
  */
 int
 make_runnable(struct thread *t)
@@ -114,11 +348,215 @@ make_runnable(struct thread *t)
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	/* The running thread has competition now. */
+	hardclock_tickless(0);
+
+	if (sched_policy == SCHED_STRIDE) {
+		if (PASS_BEFORE(t->t_pass, stride_pass)) {
+			t->t_pass = stride_pass;
+		}
+		return stride_add(t);
+	}
+
+	if (t->t_sleepaddr != NULL) {
+		if (t->t_priority > 0) {
+			t->t_priority--;
+			levelstats[t->t_priority].ls_wakeboosts++;
+		}
+		t->t_ticks = 0;
+	}
+
+	return q_addtail(runqueues[t->t_priority], t);
+}
+
+/*
+ * Anti-starvation: put every thread back on the top level with a
+ * fresh quantum.
+ */
+static
+void
+sched_boost(void)
+{
+	struct thread *t;
+	int i, result;
+
+	for (i=1; i<SCHED_LEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			t = q_remhead(runqueues[i]);
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			/* preallocated; cannot fail */
+			result = q_addtail(runqueues[0], t);
+			assert(result==0);
+		}
+	}
+	if (curthread != NULL) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	sched_boosts++;
+}
+
+/*
+ * Called from hardclock. Charges NTICKS ticks to the current thread and
+ * decides whether it should be switched out: because its quantum is
+ * used up (in which case it is also demoted), or because a thread of
+ * higher priority is waiting. There's no point switching if nobody
+ * else is runnable, though.
+ */
+int
+scheduler_tick(unsigned nticks)
+{
+	struct thread *cur = curthread;
+	int expired;
+
+	assert(curspl>0);
+
+	sched_ticks += nticks;
+
+	if (sched_policy == SCHED_STRIDE) {
+		if (cur == NULL) {
+			return 0;
+		}
+		cur->t_pass += STRIDE(cur) * nticks;
+		cur->t_ticks += nticks;
+		if (cur->t_ticks < sched_quantum || sched_empty()) {
+			return 0;
+		}
+		cur->t_ticks = 0;
+		return 1;
+	}
+
+	boost_counter += nticks;
+	if (boost_counter >= SCHED_BOOST_TICKS) {
+		boost_counter = 0;
+		sched_boost();
+	}
+
+	/* Idle loop: nobody to charge. */
+	if (cur == NULL) {
+		return 0;
+	}
+
+	cur->t_ticks += nticks;
+	expired = cur->t_ticks >= SCHED_QUANTUM(cur->t_priority);
+	if (expired) {
+		cur->t_ticks = 0;
+		if (cur->t_priority < SCHED_LEVELS-1) {
+			cur->t_priority++;
+			levelstats[cur->t_priority].ls_demotions++;
+		}
+	}
+
+	if (sched_toplevel() == SCHED_LEVELS) {
+		return 0;
+	}
+	if (expired) {
+		return 1;
+	}
+
+	if (sched_toplevel() < cur->t_priority) {
+		sched_preemptions++;
+		return 1;
+	}
+	return 0;
 }
 
 /*
- * Debugging function to dump the run queue.
+ * Set the top level's quantum to TICKS clock ticks. The lower levels'
+ * grow from it. EINVAL unless the bottom level's fits in a second.
+ */
+int
+scheduler_set_quantum(int ticks)
+{
+	int spl;
+
+	if (ticks < 1 || (ticks << (SCHED_LEVELS-1)) > HZ) {
+		return EINVAL;
+	}
+	spl = splhigh();
+	sched_quantum = ticks;
+	splx(spl);
+	return 0;
+}
+
+int
+scheduler_get_quantum(void)
+{
+	return sched_quantum;
+}
+
+int
+scheduler_set_policy(const char *name)
+{
+	struct thread *t;
+	int i, spl, policy, result;
+
+	for (policy = 0; sched_policy_names[policy] != NULL; policy++) {
+		if (!strcmp(name, sched_policy_names[policy])) {
+			break;
+		}
+	}
+	if (sched_policy_names[policy] == NULL) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	if (policy != sched_policy) {
+		/* Move everybody over; the queues are preallocated. */
+		if (policy == SCHED_STRIDE) {
+			for (i=0; i<SCHED_LEVELS; i++) {
+				while (!q_empty(runqueues[i])) {
+					t = q_remhead(runqueues[i]);
+					t->t_pass = stride_pass;
+					result = stride_add(t);
+					assert(result==0);
+				}
+			}
+		}
+		else {
+			for (i=0; i<array_getnum(stridequeue); i++) {
+				t = array_getguy(stridequeue, i);
+				result = q_addtail(runqueues[t->t_priority], t);
+				assert(result==0);
+			}
+			array_setsize(stridequeue, 0);
+		}
+		sched_policy = policy;
+	}
+	splx(spl);
+	return 0;
+}
+
+const char *
+scheduler_policy_name(void)
+{
+	return sched_policy_names[sched_policy];
+}
+
+void
+scheduler_set_tickets(struct thread *t, int tickets)
+{
+	int spl;
+
+	assert(tickets > 0 && tickets <= SCHED_MAXTICKETS);
+
+	spl = splhigh();
+	t->t_tickets = tickets;
+	splx(spl);
+}
+
+/*
+ * A voluntary switch: the next turn gets a whole quantum.
+ */
+void
+scheduler_yield(struct thread *t)
+{
+	t->t_ticks = 0;
+}
+
+/*
+ * Debugging function to dump the run queues.
  */
 void
 print_run_queue(void)
@@ -126,15 +564,42 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+	int i,k,level;
+
+	if (sched_policy == SCHED_STRIDE) {
+		kprintf("stride: pass %u (queue in heap order)\n",
+			stride_pass);
+		for (i=0; i<array_getnum(stridequeue); i++) {
+			struct thread *t = array_getguy(stridequeue, i);
+			kprintf("  %2d: %s %p tickets %d pass %u\n", i,
+				t->t_name, t->t_sleepaddr, t->t_tickets,
+				t->t_pass);
+		}
+		kprintf("%u ticks; quantum %d\n", sched_ticks, sched_quantum);
+		splx(spl);
+		return;
 	}
-	
+
+	for (level=0; level<SCHED_LEVELS; level++) {
+		kprintf("level %d (quantum %d): %u run, %u demoted, "
+			"%u woken\n", level, SCHED_QUANTUM(level),
+			levelstats[level].ls_dispatches,
+			levelstats[level].ls_demotions,
+			levelstats[level].ls_wakeboosts);
+
+		k = 0;
+		i = q_getstart(runqueues[level]);
+		while (i!=q_getend(runqueues[level])) {
+			struct thread *t = q_getguy(runqueues[level], i);
+			kprintf("  %2d: %s %p\n", k, t->t_name,
+				t->t_sleepaddr);
+			i=(i+1)%q_getsize(runqueues[level]);
+			k++;
+		}
+	}
+	kprintf("%u preemptions, %u priority boosts, %u ticks; "
+		"quantum %d\n", sched_preemptions, sched_boosts, sched_ticks,
+		sched_quantum);
+
 	splx(spl);
 }
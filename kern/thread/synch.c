@@ -8,28 +8,44 @@
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
+#include <clock.h>
 #include <machine/spl.h>
+#include <objcache.h>
 #include "opt-A1.h"
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+/* Semaphores come from here; made by the first sem_create. */
+static struct objcache *sem_objcache;
+
 struct semaphore *
 sem_create(const char *namearg, int initial_count)
 {
 	struct semaphore *sem;
+	int spl;
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	spl = splhigh();
+	if (sem_objcache == NULL) {
+		sem_objcache = objcache_create("semaphore",
+					       sizeof(struct semaphore), NULL);
+	}
+	splx(spl);
+	if (sem_objcache == NULL) {
+		return NULL;
+	}
+
+	sem = objcache_alloc(sem_objcache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->name = kstrdup(namearg);
 	if (sem->name == NULL) {
-		kfree(sem);
+		objcache_free(sem_objcache, sem);
 		return NULL;
 	}
 
@@ -57,7 +73,7 @@ sem_destroy(struct semaphore *sem)
 	 */
 
 	kfree(sem->name);
-	kfree(sem);
+	objcache_free(sem_objcache, sem);
 }
 
 void 
@@ -95,14 +111,192 @@ V(struct semaphore *sem)
 	splx(spl);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Spinlock.
+
+void
+spinlock_init(struct spinlock *sl)
+{
+	sl->sl_locked = 0;
+	sl->sl_holder = NULL;
+	sl->sl_spl = 0;
+}
+
+void
+spinlock_acquire(struct spinlock *sl)
+{
+	int spl;
+	assert(sl != NULL);
+
+	spl = splhigh();
+
+	/*
+	 * With more than one CPU this would be a test-and-set loop.
+	 * With one, and interrupts off, nobody else can let go.
+	 */
+	if (sl->sl_locked) {
+		if (sl->sl_holder == curthread) {
+			panic("spinlock_acquire: %p already held by this "
+			      "thread\n", sl);
+		}
+		panic("spinlock_acquire: %p held by another thread\n", sl);
+	}
+
+	sl->sl_locked = 1;
+	sl->sl_holder = curthread;
+	sl->sl_spl = spl;
+}
+
+void
+spinlock_release(struct spinlock *sl)
+{
+	int spl;
+	assert(sl != NULL);
+	assert(curspl == SPL_HIGH);
+	assert(spinlock_do_i_hold(sl));
+
+	spl = sl->sl_spl;
+	sl->sl_holder = NULL;
+	sl->sl_locked = 0;
+	splx(spl);
+}
+
+int
+spinlock_do_i_hold(struct spinlock *sl)
+{
+	return sl->sl_locked && sl->sl_holder == curthread;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mutex.
+
+/*
+ * How many times mutex_acquire polls a held mutex before sleeping.
+ * On one CPU the owner only gets to run if the timer preempts us
+ * while we poll, so this is kept short; with more CPUs it would be
+ * worth spinning while the owner is running elsewhere.
+ */
+#define MUTEX_SPINS	100
+
+/* Totals over all mutexes, for lock_printstats. */
+static unsigned mutex_acquires;
+static unsigned mutex_spun;	/* got it by spinning */
+static unsigned mutex_slept;	/* had to sleep for it */
+
+struct mutex *
+mutex_create(const char *name)
+{
+	struct mutex *mtx;
+
+	mtx = kmalloc(sizeof(struct mutex));
+	if (mtx == NULL) {
+		return NULL;
+	}
+
+	mtx->name = kstrdup(name);
+	if (mtx->name == NULL) {
+		kfree(mtx);
+		return NULL;
+	}
+
+	mtx->mtx_owner = NULL;
+	mtx->mtx_waiters = 0;
+	return mtx;
+}
+
+void
+mutex_destroy(struct mutex *mtx)
+{
+	int spl;
+	assert(mtx != NULL);
+
+	spl = splhigh();
+	assert(mtx->mtx_owner == NULL);
+	assert(mtx->mtx_waiters == 0);
+	splx(spl);
+
+	kfree(mtx->name);
+	kfree(mtx);
+}
+
+void
+mutex_acquire(struct mutex *mtx)
+{
+	int spl, i;
+	assert(mtx != NULL);
+
+	/* May not block in an interrupt handler. */
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	assert(mtx->mtx_owner != curthread);
+	mutex_acquires++;
+
+	/*
+	 * Polling only helps if something can run meanwhile, so don't
+	 * bother if the caller already had interrupts off.
+	 */
+	if (mtx->mtx_owner != NULL && spl == 0) {
+		splx(spl);
+		for (i=0; i<MUTEX_SPINS && mtx->mtx_owner != NULL; i++);
+		splhigh();
+		if (mtx->mtx_owner == NULL) {
+			mutex_spun++;
+		}
+	}
+
+	if (mtx->mtx_owner != NULL) {
+		mutex_slept++;
+		mtx->mtx_waiters++;
+		while (mtx->mtx_owner != NULL) {
+			thread_sleep(mtx);
+		}
+		mtx->mtx_waiters--;
+	}
+
+	mtx->mtx_owner = curthread;
+	splx(spl);
+}
+
+void
+mutex_release(struct mutex *mtx)
+{
+	int spl;
+	assert(mtx != NULL);
+
+	spl = splhigh();
+	assert(mtx->mtx_owner == curthread);
+	mtx->mtx_owner = NULL;
+	if (mtx->mtx_waiters > 0) {
+		thread_single_wakeup(mtx);
+	}
+	splx(spl);
+}
+
+int
+mutex_do_i_hold(struct mutex *mtx)
+{
+	return mtx->mtx_owner == curthread;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
 
+#if OPT_A1
+/* Every lock in existence, for lock_printstats. */
+static struct lock *alllocks;
+#endif /* OPT_A1 */
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
+	#if OPT_A1
+	int spl;
+	#endif /* OPT_A1 */
 
 	lock = kmalloc(sizeof(struct lock));
 	if (lock == NULL) {
@@ -117,6 +311,18 @@ lock_create(const char *name)
 	
 	#if OPT_A1
 	lock->owner = NULL;
+	lock->acquires = 0;
+	lock->contended = 0;
+	lock->waitticks = 0;
+
+	spl = splhigh();
+	lock->prev = NULL;
+	lock->next = alllocks;
+	if (alllocks != NULL) {
+		alllocks->prev = lock;
+	}
+	alllocks = lock;
+	splx(spl);
 	#endif /* OPT_A1 */
 	
 	return lock;
@@ -125,12 +331,27 @@ lock_create(const char *name)
 void
 lock_destroy(struct lock *lock)
 {
+	#if OPT_A1
+	int spl;
+	#endif /* OPT_A1 */
+
 	assert(lock != NULL);
 
 	#if OPT_A1
+	spl = splhigh();
 	assert(lock->owner == NULL);
+	assert(thread_hassleepers(lock)==0);
 
-	kfree(lock->owner);
+	if (lock->prev != NULL) {
+		lock->prev->next = lock->next;
+	}
+	else {
+		alllocks = lock->next;
+	}
+	if (lock->next != NULL) {
+		lock->next->prev = lock->prev;
+	}
+	splx(spl);
 	#endif /* OPT_A1 */
 	
 	kfree(lock->name);
@@ -141,23 +362,31 @@ void
 lock_acquire(struct lock *lock)
 {
 	#if OPT_A1
+	u_int32_t start;
 	int spl;
 	assert(lock != NULL);
 
+	/* May not block in an interrupt handler. */
+	assert(in_interrupt==0);
+
 	spl = splhigh();
-	
-	while(1)
-	{
-		if(lock->owner == NULL) 
-		{
-			lock->owner = curthread;
-			splx(spl);
-			return;
-		}
-		else 
-		{
+	assert(lock->owner != curthread);
+
+	lock->acquires++;
+	if (lock->owner != NULL) {
+		/*
+		 * Wait in line. lock_release makes us the owner before
+		 * waking us up, so there's nothing to retry.
+		 */
+		lock->contended++;
+		start = hardclock_ticks;
+		while (lock->owner != curthread) {
 			thread_sleep(lock);
 		}
+		lock->waitticks += hardclock_ticks - start;
+	}
+	else {
+		lock->owner = curthread;
 	}
 
 	splx(spl);
@@ -176,8 +405,8 @@ lock_release(struct lock *lock)
 	spl = splhigh();
 	if(lock_do_i_hold(lock)) 
 	{
-		lock->owner = NULL;
-		thread_wakeup(lock);
+		/* Hand over to the longest waiter, if any. */
+		lock->owner = thread_single_wakeup(lock);
 	}
 	splx(spl);
 	#endif /* OPT_A1 */
@@ -201,6 +430,30 @@ lock_do_i_hold(struct lock *lock)
 	return 1;    // dummy until code gets written
 }
 
+void
+lock_printstats(void)
+{
+	#if OPT_A1
+	struct lock *lock;
+	int spl;
+
+	/* Turn interrupts off so the whole list prints atomically. */
+	spl = splhigh();
+	kprintf("%-24s %10s %10s %10s\n", "lock", "acquires", "contended",
+		"waitticks");
+	for (lock = alllocks; lock != NULL; lock = lock->next) {
+		if (lock->acquires == 0) {
+			continue;
+		}
+		kprintf("%-24s %10u %10u %10u\n", lock->name,
+			lock->acquires, lock->contended, lock->waitticks);
+	}
+	kprintf("mutexes: %u acquires, %u got by spinning, %u slept\n",
+		mutex_acquires, mutex_spun, mutex_slept);
+	splx(spl);
+	#endif /* OPT_A1 */
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -222,8 +475,6 @@ cv_create(const char *name)
 		return NULL;
 	}
 	
-	// add stuff here as needed
-	
 	return cv;
 }
 
@@ -232,8 +483,6 @@ cv_destroy(struct cv *cv)
 {
 	assert(cv != NULL);
 
-	// add stuff here as needed
-	
 	kfree(cv->name);
 	kfree(cv);
 }
@@ -252,7 +501,12 @@ cv_wait(struct cv *cv, struct lock *lock)
 		spl = splhigh();
 		lock_release(lock);
 		thread_sleep(cv);
-		lock_acquire(lock);
+
+		/*
+		 * cv_signal moved us to the lock's queue, and
+		 * lock_release has since handed us the lock.
+		 */
+		assert(lock_do_i_hold(lock));
 		splx(spl);
 	}
 	#endif /* OPT_A1 */
@@ -273,7 +527,10 @@ cv_signal(struct cv *cv, struct lock *lock)
 		assert(cv != NULL);
 
 		spl = splhigh();
-		thread_single_wakeup(cv);
+		if (thread_requeue(cv, lock) != NULL) {
+			lock->acquires++;
+			lock->contended++;
+		}
 		splx(spl);
 	}
 	#endif /* OPT_A1 */
@@ -294,7 +551,10 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 		assert (cv != NULL);
 
 		spl = splhigh();
-		thread_wakeup(cv);
+		while (thread_requeue(cv, lock) != NULL) {
+			lock->acquires++;
+			lock->contended++;
+		}
 		splx(spl);
 	}
 	#endif /* OPT_A1 */
@@ -302,3 +562,124 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	(void)cv;    // suppress warning until code gets written
 	(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// Readers sleep on the rwlock itself, writers on its writer field.
+
+#define RW_WRITERS(rw)	((const void *)&(rw)->writer)
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->name = kstrdup(name);
+	if (rw->name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->readers = 0;
+	rw->writers_waiting = 0;
+	rw->writer = NULL;
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	int spl;
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->readers == 0);
+	assert(rw->writer == NULL);
+	assert(rw->writers_waiting == 0);
+	splx(spl);
+
+	kfree(rw->name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	int spl;
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	assert(rw->writer != curthread);
+	while (rw->writer != NULL || rw->writers_waiting > 0) {
+		thread_sleep(rw);
+	}
+	rw->readers++;
+	splx(spl);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	int spl;
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->readers > 0);
+	rw->readers--;
+	if (rw->readers == 0 && rw->writers_waiting > 0) {
+		thread_wakeup(RW_WRITERS(rw));
+	}
+	splx(spl);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	int spl;
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	assert(rw->writer != curthread);
+	rw->writers_waiting++;
+	while (rw->writer != NULL || rw->readers > 0) {
+		thread_sleep(RW_WRITERS(rw));
+	}
+	rw->writers_waiting--;
+	rw->writer = curthread;
+	splx(spl);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	int spl;
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->writer == curthread);
+	rw->writer = NULL;
+
+	/* Writers first; readers only when none are left. */
+	if (rw->writers_waiting > 0) {
+		thread_wakeup(RW_WRITERS(rw));
+	}
+	else {
+		thread_wakeup(rw);
+	}
+	splx(spl);
+}
+
+int
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	return rw->writer == curthread;
+}
@@ -11,6 +11,8 @@
 #include <thread.h>
 #include <curthread.h>
 #include <scheduler.h>
+#include <workqueue.h>
+#include <objcache.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include "opt-synchprobs.h"
@@ -28,15 +30,130 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Sleeping threads, hashed on their sleep address. Each bucket is a
+ * doubly linked list through t_sleepnext/t_sleepprev, oldest sleeper
+ * first, so a wakeup only looks at threads that hashed alike.
+ */
+#define SLEEPQ_BUCKETS	64
+
+struct sleepq {
+	struct thread *sq_head;
+	struct thread *sq_tail;
+};
+
+static struct sleepq sleepqs[SLEEPQ_BUCKETS];
+
+/* Cleared by thread_shutdown. */
+static int sleepqs_live;
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
 
+/* Disposes of them on sys_workq. */
+static struct work exorcise_work;
+
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
 
+/* How many of those are daemons (see thread_daemonize). */
+static int numdaemons;
+
+/* All of those, for thread_printusage. Accessed with interrupts off. */
+static struct thread *allthreads;
+
+/*
+ * Caches of thread structures and stacks of threads that have been
+ * reaped, so thread_fork can usually do without kmalloc. Bounded, so
+ * a burst of threads doesn't tie up the memory for good; beyond that
+ * they're freed as before. Accessed with interrupts off.
+ */
+#define THREAD_CACHE_MAX	16
+
+static struct thread *thread_cache[THREAD_CACHE_MAX];
+static char *stack_cache[THREAD_CACHE_MAX];
+static int thread_ncached, stack_ncached;
+
+static unsigned thread_cache_hits, thread_cache_misses;
+
+/* Where thread structures come from when the cache above is empty. */
+static struct objcache *thread_objcache;
+static unsigned stack_cache_hits, stack_cache_misses;
+
+static
+struct thread *
+thread_alloc(void)
+{
+	int s = splhigh();
+
+	if (thread_ncached > 0) {
+		thread_cache_hits++;
+		splx(s);
+		return thread_cache[--thread_ncached];
+	}
+	thread_cache_misses++;
+	splx(s);
+	return objcache_alloc(thread_objcache);
+}
+
+static
+void
+thread_free(struct thread *thread)
+{
+	int s = splhigh();
+
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	if (thread_ncached < THREAD_CACHE_MAX) {
+		thread_cache[thread_ncached++] = thread;
+	}
+	else {
+		objcache_free(thread_objcache, thread);
+	}
+	splx(s);
+}
+
+static
+char *
+stack_alloc(void)
+{
+	int s = splhigh();
+
+	if (stack_ncached > 0) {
+		stack_cache_hits++;
+		splx(s);
+		return stack_cache[--stack_ncached];
+	}
+	stack_cache_misses++;
+	splx(s);
+	return kmalloc(STACK_SIZE);
+}
+
+static
+void
+stack_free(char *stack)
+{
+	int s = splhigh();
+
+	if (stack_ncached < THREAD_CACHE_MAX) {
+		stack_cache[stack_ncached++] = stack;
+	}
+	else {
+		kfree(stack);
+	}
+	splx(s);
+}
+
+void
+thread_printstats(void)
+{
+	kprintf("thread cache: %u hits, %u misses, %d cached\n",
+		thread_cache_hits, thread_cache_misses, thread_ncached);
+	kprintf("stack cache:  %u hits, %u misses, %d cached\n",
+		stack_cache_hits, stack_cache_misses, stack_ncached);
+}
+
 /*
  * Create a thread. This is used both to create the first thread's 
  * thread structure and to create subsequent threads.
@@ -46,17 +163,35 @@ static
 struct thread *
 thread_create(const char *name)
 {
-	struct thread *thread = kmalloc(sizeof(struct thread));
+	struct thread *thread = thread_alloc();
 	if (thread==NULL) {
 		return NULL;
 	}
-	thread->t_name = kstrdup(name);
-	if (thread->t_name==NULL) {
-		kfree(thread);
-		return NULL;
+	if (strlen(name) < THREAD_NAMELEN) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+	}
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name==NULL) {
+			thread->t_name = thread->t_namebuf;
+			thread_free(thread);
+			return NULL;
+		}
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_sleepnext = NULL;
+	thread->t_sleepprev = NULL;
 	thread->t_stack = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_tickets = SCHED_DEFTICKETS;
+	thread->t_pass = 0;
+	thread->t_allnext = NULL;
+	thread->t_allprev = NULL;
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	thread->t_stampsecs = 0;
+	thread->t_stampnsecs = 0;
 	
 	thread->t_vmspace = NULL;
 
@@ -89,13 +224,263 @@ thread_destroy(struct thread *thread)
 	assert(thread->t_cwd==NULL);
 	
 	if (thread->t_stack) {
-		kfree(thread->t_stack);
+		stack_free(thread->t_stack);
+	}
+
+	thread_free(thread);
+}
+
+
+/*
+ * Find the sleep queue for sleep address ADDR. Sleep addresses are
+ * mostly pointers to kernel objects, so the low bits carry little;
+ * fold some higher ones in.
+ */
+static
+struct sleepq *
+sleepq_get(const void *addr)
+{
+	u_int32_t a = (u_int32_t) addr;
+
+	return &sleepqs[((a >> 4) ^ (a >> 10)) % SLEEPQ_BUCKETS];
+}
+
+/*
+ * Queue T on the sleep queue for its sleep address. Queued at the
+ * tail, so wakeups go oldest first.
+ */
+static
+void
+sleepq_add(struct thread *t)
+{
+	struct sleepq *sq = sleepq_get(t->t_sleepaddr);
+
+	t->t_sleepnext = NULL;
+	t->t_sleepprev = sq->sq_tail;
+	if (sq->sq_tail != NULL) {
+		sq->sq_tail->t_sleepnext = t;
+	}
+	else {
+		sq->sq_head = t;
+	}
+	sq->sq_tail = t;
+}
+
+static
+void
+sleepq_remove(struct sleepq *sq, struct thread *t)
+{
+	if (t->t_sleepprev != NULL) {
+		t->t_sleepprev->t_sleepnext = t->t_sleepnext;
+	}
+	else {
+		sq->sq_head = t->t_sleepnext;
+	}
+	if (t->t_sleepnext != NULL) {
+		t->t_sleepnext->t_sleepprev = t->t_sleepprev;
+	}
+	else {
+		sq->sq_tail = t->t_sleepprev;
+	}
+	t->t_sleepnext = t->t_sleepprev = NULL;
+}
+
+static
+void
+allthreads_add(struct thread *t)
+{
+	t->t_allprev = NULL;
+	t->t_allnext = allthreads;
+	if (allthreads != NULL) {
+		allthreads->t_allprev = t;
+	}
+	allthreads = t;
+}
+
+static
+void
+allthreads_remove(struct thread *t)
+{
+	if (t->t_allprev != NULL) {
+		t->t_allprev->t_allnext = t->t_allnext;
+	}
+	else {
+		allthreads = t->t_allnext;
+	}
+	if (t->t_allnext != NULL) {
+		t->t_allnext->t_allprev = t->t_allprev;
+	}
+	t->t_allnext = t->t_allprev = NULL;
+}
+
+/*
+ * Add the time from T's stamp until NOWSECS/NOWNSECS onto the time in
+ * SECS and NSECS, and move the stamp up to now. A zero stamp means the
+ * clock wasn't there yet when it was taken, so there's nothing to add.
+ */
+static
+void
+thread_chargetime(struct thread *t, time_t *secs, u_int32_t *nsecs,
+		  time_t nowsecs, u_int32_t nownsecs)
+{
+	time_t rsecs;
+	u_int32_t rnsecs;
+
+	if (t->t_stampsecs != 0 || t->t_stampnsecs != 0) {
+		getinterval(t->t_stampsecs, t->t_stampnsecs,
+			    nowsecs, nownsecs, &rsecs, &rnsecs);
+		*secs += rsecs;
+		*nsecs += rnsecs;
+		if (*nsecs >= 1000000000) {
+			*nsecs -= 1000000000;
+			(*secs)++;
+		}
+	}
+	t->t_stampsecs = nowsecs;
+	t->t_stampnsecs = nownsecs;
+}
+
+/*
+ * T, which was asleep, is being woken up: charge it for the sleep.
+ */
+static
+void
+thread_chargesleep(struct thread *t)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	hardclock_gettime(&secs, &nsecs);
+	thread_chargetime(t, &t->t_usage.cu_sleepsecs,
+			  &t->t_usage.cu_sleepnsecs, secs, nsecs);
+}
+
+static
+void
+cpuusage_add(struct cpuusage *to, const struct cpuusage *from)
+{
+	to->cu_ticks += from->cu_ticks;
+	to->cu_nvcsw += from->cu_nvcsw;
+	to->cu_nivcsw += from->cu_nivcsw;
+	to->cu_runsecs += from->cu_runsecs;
+	to->cu_runnsecs += from->cu_runnsecs;
+	if (to->cu_runnsecs >= 1000000000) {
+		to->cu_runnsecs -= 1000000000;
+		to->cu_runsecs++;
+	}
+	to->cu_sleepsecs += from->cu_sleepsecs;
+	to->cu_sleepnsecs += from->cu_sleepnsecs;
+	if (to->cu_sleepnsecs >= 1000000000) {
+		to->cu_sleepnsecs -= 1000000000;
+		to->cu_sleepsecs++;
 	}
+}
+
+/*
+ * Bring the current thread's run time up to now.
+ */
+static
+void
+thread_chargecur(void)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	hardclock_gettime(&secs, &nsecs);
+	thread_chargetime(curthread, &curthread->t_usage.cu_runsecs,
+			  &curthread->t_usage.cu_runnsecs, secs, nsecs);
+}
+
+void
+thread_addusage(struct cpuusage *usage)
+{
+	int s = splhigh();
 
-	kfree(thread->t_name);
-	kfree(thread);
+	thread_chargecur();
+	cpuusage_add(usage, &curthread->t_usage);
+	splx(s);
 }
 
+/* What thread_printusage keeps of each thread. */
+struct threadusage {
+	char tu_name[THREAD_NAMELEN];
+	int tu_pid;
+	struct cpuusage tu_usage;
+};
+
+#define RUN_MSECS(cu) \
+	((unsigned long)(cu)->cu_runsecs * 1000 + (cu)->cu_runnsecs / 1000000)
+#define SLEEP_MSECS(cu) \
+	((unsigned long)(cu)->cu_sleepsecs * 1000 + \
+	 (cu)->cu_sleepnsecs / 1000000)
+
+void
+thread_printusage(void)
+{
+	struct threadusage *tus, tmp;
+	struct thread *t;
+	u_int32_t idle, ticks;
+	int s, i, j, n, max;
+
+	/*
+	 * Copy out what we need with interrupts off, then sort and
+	 * print at leisure. Leave room for a few threads being forked
+	 * meanwhile; any more are left out.
+	 */
+	max = numthreads + 4;
+	tus = kmalloc(max * sizeof(struct threadusage));
+	if (tus == NULL) {
+		kprintf("thread_printusage: Out of memory\n");
+		return;
+	}
+
+	s = splhigh();
+	thread_chargecur();
+	n = 0;
+	for (t = allthreads; t != NULL && n < max; t = t->t_allnext) {
+		snprintf(tus[n].tu_name, THREAD_NAMELEN, "%s", t->t_name);
+		tus[n].tu_pid = -1;
+		#if OPT_A2
+		if (t->t_process != NULL) {
+			tus[n].tu_pid = t->t_process->pid;
+		}
+		#endif /* OPT_A2 */
+		tus[n].tu_usage = t->t_usage;
+		n++;
+	}
+	idle = hardclock_idleticks;
+	ticks = hardclock_ticks;
+	splx(s);
+
+	/* Insertion sort, most run time first. */
+	for (i=1; i<n; i++) {
+		tmp = tus[i];
+		for (j=i; j>0 && RUN_MSECS(&tus[j-1].tu_usage) <
+			     RUN_MSECS(&tmp.tu_usage); j--) {
+			tus[j] = tus[j-1];
+		}
+		tus[j] = tmp;
+	}
+
+	kprintf("%-16s %4s %8s %9s %9s %7s %7s\n", "thread", "pid",
+		"ticks", "run ms", "sleep ms", "vcsw", "ivcsw");
+	for (i=0; i<n; i++) {
+		struct cpuusage *cu = &tus[i].tu_usage;
+
+		if (tus[i].tu_pid < 0) {
+			kprintf("%-16s %4s ", tus[i].tu_name, "-");
+		}
+		else {
+			kprintf("%-16s %4d ", tus[i].tu_name, tus[i].tu_pid);
+		}
+		kprintf("%8u %9lu %9lu %7u %7u\n", cu->cu_ticks,
+			RUN_MSECS(cu), SLEEP_MSECS(cu), cu->cu_nvcsw,
+			cu->cu_nivcsw);
+	}
+	kprintf("idle: %u of %u ticks\n", idle, ticks);
+
+	kfree(tus);
+}
 
 /*
  * Remove zombies. (Zombies are threads/processes that have exited but not
@@ -119,6 +504,25 @@ exorcise(void)
 	assert(result==0);
 }
 
+/*
+ * Work function for exorcise_work.
+ */
+static
+void
+exorcise_worker(void *unused1, unsigned long unused2)
+{
+	int s;
+
+	(void)unused1;
+	(void)unused2;
+
+	s = splhigh();
+	if (zombies != NULL) {
+		exorcise();
+	}
+	splx(s);
+}
+
 /*
  * Kill all sleeping threads. This is used during panic shutdown to make 
  * sure they don't wake up again and interfere with the panic.
@@ -127,7 +531,8 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	struct thread *t;
+	int i;
 
 	assert(curspl>0);
 
@@ -136,23 +541,22 @@ thread_killall(void)
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
+	for (i=0; i<SLEEPQ_BUCKETS; i++) {
+		t = sleepqs[i].sq_head;
+		for (; t != NULL; t = t->t_sleepnext) {
+			kprintf("sleep: Dropping thread %s\n", t->t_name);
 
-		/*
-		 * Don't do this: because these threads haven't
-		 * been through thread_exit, thread_destroy will
-		 * get upset. Just drop the threads on the floor,
-		 * which is safer anyway during panic.
-		 *
-		 * array_add(zombies, t);
-		 */
+			/*
+			 * Don't do this: because these threads haven't
+			 * been through thread_exit, thread_destroy will
+			 * get upset. Just drop the threads on the floor,
+			 * which is safer anyway during panic.
+			 *
+			 * array_add(zombies, t);
+			 */
+		}
+		sleepqs[i].sq_head = sleepqs[i].sq_tail = NULL;
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -197,11 +601,25 @@ one_thread_only() {
   /* numthreads is a shared variable, so turn interrupts
      off to ensure that we can inspect its value atomically */
   s = splhigh();
-  n = numthreads;
+  n = numthreads - numdaemons;
   splx(s);
   return(n==1);
 }
 
+/*
+ * Mark the current thread as a daemon.
+ */
+void
+thread_daemonize(void)
+{
+	int s;
+
+	s = splhigh();
+	numdaemons++;
+	assert(numdaemons < numthreads);
+	splx(s);
+}
+
 
 /*
  * Thread initialization.
@@ -212,15 +630,19 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+	sleepqs_live = 1;
+
+	thread_objcache = objcache_create("thread", sizeof(struct thread),
+					  NULL);
+	if (thread_objcache==NULL) {
+		panic("Cannot create thread object cache\n");
 	}
 
 	zombies = array_create();
 	if (zombies==NULL) {
 		panic("Cannot create zombies array\n");
 	}
+	work_init(&exorcise_work, exorcise_worker, NULL, 0);
 	
 	/*
 	 * Create the thread structure for the first thread
@@ -245,6 +667,7 @@ thread_bootstrap(void)
 	
 	/* Set curthread */
 	curthread = me;
+	allthreads_add(me);
 
 	/* Number of threads starts at 1 */
 	numthreads = 1;
@@ -259,10 +682,16 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
+	sleepqs_live = 0;
 	array_destroy(zombies);
 	zombies = NULL;
+	while (thread_ncached > 0) {
+		objcache_free(thread_objcache,
+			      thread_cache[--thread_ncached]);
+	}
+	while (stack_ncached > 0) {
+		kfree(stack_cache[--stack_ncached]);
+	}
 	// Don't do this - it frees our stack and we blow up
 	//thread_destroy(curthread);
 }
@@ -288,10 +717,9 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
-	newguy->t_stack = kmalloc(STACK_SIZE);
+	newguy->t_stack = stack_alloc();
 	if (newguy->t_stack==NULL) {
-		kfree(newguy->t_name);
-		kfree(newguy);
+		thread_free(newguy);
 		return ENOMEM;
 	}
 
@@ -301,6 +729,9 @@ thread_fork(const char *name,
 	newguy->t_stack[2] = 0xda;
 	newguy->t_stack[3] = 0x33;
 
+	/* Inherit the CPU share */
+	newguy->t_tickets = curthread->t_tickets;
+
 	/* Inherit the current directory */
 	if (curthread->t_cwd != NULL) {
 		VOP_INCREF(curthread->t_cwd);
@@ -315,13 +746,11 @@ thread_fork(const char *name,
 
 	/*
 	 * Make sure our data structures have enough space, so we won't
-	 * run out later at an inconvenient time.
+	 * run out later at an inconvenient time. (Zombies wait on
+	 * zombies[] for the work queue, so there may be some already.)
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
-	}
-	result = array_preallocate(zombies, numthreads+1);
+	result = array_preallocate(zombies,
+				   numthreads + array_getnum(zombies) + 1);
 	if (result) {
 		goto fail;
 	}
@@ -345,6 +774,7 @@ thread_fork(const char *name,
 	 * existence.
 	 */
 	numthreads++;
+	allthreads_add(newguy);
 
 	/* Done with stuff that needs to be atomic */
 	splx(s);
@@ -366,9 +796,8 @@ thread_fork(const char *name,
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
 	}
-	kfree(newguy->t_stack);
-	kfree(newguy->t_name);
-	kfree(newguy);
+	stack_free(newguy->t_stack);
+	thread_free(newguy);
 
 	return result;
 }
@@ -381,6 +810,8 @@ void
 mi_switch(threadstate_t nextstate)
 {
 	struct thread *cur, *next;
+	time_t secs;
+	u_int32_t nsecs;
 	int result;
 	
 	/* Interrupts should already be off. */
@@ -411,6 +842,21 @@ mi_switch(threadstate_t nextstate)
 	cur = curthread;
 	curthread = NULL;
 
+	/*
+	 * Charge the time since it was switched in, and count the
+	 * switch. Yielding from hardclock is being preempted; anything
+	 * else is giving up the CPU on purpose.
+	 */
+	hardclock_gettime(&secs, &nsecs);
+	thread_chargetime(cur, &cur->t_usage.cu_runsecs,
+			  &cur->t_usage.cu_runnsecs, secs, nsecs);
+	if (nextstate==S_READY && in_interrupt) {
+		cur->t_usage.cu_nivcsw++;
+	}
+	else {
+		cur->t_usage.cu_nvcsw++;
+	}
+
 	/*
 	 * Stash the current thread on whatever list it's supposed to go on.
 	 * Because we preallocate during thread_fork, this should not fail.
@@ -420,11 +866,8 @@ mi_switch(threadstate_t nextstate)
 		result = make_runnable(cur);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		sleepq_add(cur);
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -440,6 +883,9 @@ mi_switch(threadstate_t nextstate)
 
 	/* update curthread */
 	curthread = next;
+
+	/* Its run starts now (not when the idle loop found it). */
+	hardclock_gettime(&next->t_stampsecs, &next->t_stampnsecs);
 	
 	/* 
 	 * Call the machine-dependent code that actually does the
@@ -453,16 +899,23 @@ mi_switch(threadstate_t nextstate)
 	 * or not apply to new threads.
 	 *
 	 * exorcise is skippable; as_activate is done in mi_threadstart.
+	 *
+	 * Zombies are left to a worker on sys_workq, so that the cost
+	 * of freeing them doesn't land on whoever happens to run next;
+	 * until the work queues are up, do it here.
 	 */
 
-	exorcise();
+	if (sys_workq == NULL) {
+		exorcise();
+	}
 	
-	#if OPT_A3
-	#else
+	/*
+	 * Under OPT_A3 this only switches the TLB's address space ID;
+	 * the TLB is flushed only when the IDs run out.
+	 */
 	if (curthread->t_vmspace) {
 		as_activate(curthread->t_vmspace);
 	}
-	#endif
 }
 
 /*
@@ -508,6 +961,11 @@ thread_exit(void)
 
 	assert(numthreads>0);
 	numthreads--;
+	allthreads_remove(curthread);
+	if (sys_workq != NULL) {
+		/* Nothing runs before we're on zombies[]. */
+		workqueue_post(sys_workq, &exorcise_work);
+	}
 	mi_switch(S_ZOMB);
 
 	panic("Thread came back from the dead!\n");
@@ -522,7 +980,12 @@ thread_yield(void)
 	int spl = splhigh();
 
 	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
+	assert(sleepqs_live);
+
+	/* Preemption from hardclock doesn't count as voluntary. */
+	if (!in_interrupt) {
+		scheduler_yield(curthread);
+	}
 
 	mi_switch(S_READY);
 	splx(spl);
@@ -557,22 +1020,19 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct sleepq *sq;
+	struct thread *t, *next;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
+
+	sq = sleepq_get(addr);
+	for (t = sq->sq_head; t != NULL; t = next) {
+		next = t->t_sleepnext;
 		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
+			sleepq_remove(sq, t);
+			thread_chargesleep(t);
 
 			/*
 			 * Because we preallocate during thread_fork,
@@ -583,25 +1043,73 @@ thread_wakeup(const void *addr)
 		}
 	}
 }
+
 #if OPT_A1
-void thread_single_wakeup( const void *addr ) {
-    int i, result;
-    assert( curspl > 0 );
-    for( i = 0; i < array_getnum( sleepers ); i += 1 ) {
-        struct thread *t = array_getguy( sleepers, i );
-        if( t->t_sleepaddr == addr ) {
-            array_remove( sleepers, i );
-            result = make_runnable( t );
-            assert( result == 0 );
-            // I don't know how far 'break' goes in C
-            // so I made i bigger than the for constraints
-            // in case break fails
-            i = array_getnum( sleepers ) + 2;
-            break;
-        }
-    }
+/*
+ * Find the thread that has been sleeping longest on ADDR, or NULL.
+ */
+static
+struct thread *
+sleepq_oldest(struct sleepq *sq, const void *addr)
+{
+	struct thread *t;
+
+	for (t = sq->sq_head; t != NULL; t = t->t_sleepnext) {
+		if (t->t_sleepaddr == addr) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Wake up the thread that has been sleeping longest on ADDR, if any,
+ * and return it.
+ */
+struct thread *
+thread_single_wakeup(const void *addr)
+{
+	struct sleepq *sq;
+	struct thread *t;
+	int result;
+
+	assert(curspl>0);
+
+	sq = sleepq_get(addr);
+	t = sleepq_oldest(sq, addr);
+	if (t != NULL) {
+		sleepq_remove(sq, t);
+		thread_chargesleep(t);
+		result = make_runnable(t);
+		assert(result==0);
+	}
+	return t;
+}
+
+/*
+ * Move the thread that has been sleeping longest on FROM, if any, to
+ * the back of the line of threads sleeping on TO, without waking it.
+ * Returns it.
+ */
+struct thread *
+thread_requeue(const void *from, const void *to)
+{
+	struct sleepq *sq;
+	struct thread *t;
+
+	assert(curspl>0);
+
+	sq = sleepq_get(from);
+	t = sleepq_oldest(sq, from);
+	if (t != NULL) {
+		sleepq_remove(sq, t);
+		t->t_sleepaddr = to;
+		sleepq_add(t);
+	}
+	return t;
 }
 #endif
+
 /*
  * Return nonzero if there are any threads who are sleeping on "sleep address"
  * ADDR. This is meant to be used only for diagnostic purposes.
@@ -609,13 +1117,12 @@ void thread_single_wakeup( const void *addr ) {
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
+	struct thread *t;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
+	for (t = sleepq_get(addr)->sq_head; t != NULL; t = t->t_sleepnext) {
 		if (t->t_sleepaddr == addr) {
 			return 1;
 		}
@@ -0,0 +1,186 @@
+/*
+ * Work queues. See workqueue.h.
+ *
+ * A queue is a singly linked list of work items, guarded by turning
+ * interrupts off. Idle workers sleep on the queue itself.
+ */
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <workqueue.h>
+
+/* Number of workers serving sys_workq. */
+#define SYS_WORKERS	1
+
+struct workqueue *sys_workq;
+
+/* Every queue, for workqueue_printstats. */
+static struct workqueue *allqueues;
+
+static
+void
+workqueue_worker(void *data1, unsigned long unused)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+	void (*func)(void *, unsigned long);
+	void *arg1;
+	unsigned long arg2;
+
+	(void)unused;
+
+	thread_daemonize();
+
+	splhigh();
+	while (1) {
+		while (wq->wq_head == NULL) {
+			thread_sleep(wq);
+		}
+
+		w = wq->wq_head;
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = NULL;
+		}
+		wq->wq_len--;
+
+		/*
+		 * Once it's off the queue the item may be posted again,
+		 * even while it's running, so take the call apart first.
+		 */
+		w->w_next = NULL;
+		w->w_queued = 0;
+		func = w->w_func;
+		arg1 = w->w_data1;
+		arg2 = w->w_data2;
+
+		spl0();
+		func(arg1, arg2);
+		splhigh();
+
+		wq->wq_runs++;
+	}
+}
+
+struct workqueue *
+workqueue_create(const char *name, int nworkers)
+{
+	struct workqueue *wq;
+	int i, result, s;
+
+	assert(nworkers > 0);
+
+	wq = kmalloc(sizeof(struct workqueue));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_head = wq->wq_tail = NULL;
+	wq->wq_len = 0;
+	wq->wq_nworkers = 0;
+	wq->wq_posts = 0;
+	wq->wq_runs = 0;
+	wq->wq_maxlen = 0;
+
+	/*
+	 * Workers can't be stopped, so once the first is started the
+	 * queue has to stay; make do with however many we got.
+	 */
+	for (i=0; i<nworkers; i++) {
+		result = thread_fork(wq->wq_name, wq, i, workqueue_worker,
+				     NULL);
+		if (result) {
+			break;
+		}
+		wq->wq_nworkers++;
+	}
+	if (wq->wq_nworkers == 0) {
+		kfree(wq->wq_name);
+		kfree(wq);
+		return NULL;
+	}
+
+	s = splhigh();
+	wq->wq_next = allqueues;
+	allqueues = wq;
+	splx(s);
+
+	return wq;
+}
+
+void
+work_init(struct work *w, void (*func)(void *, unsigned long),
+	  void *data1, unsigned long data2)
+{
+	w->w_func = func;
+	w->w_data1 = data1;
+	w->w_data2 = data2;
+	w->w_next = NULL;
+	w->w_queued = 0;
+}
+
+int
+workqueue_post(struct workqueue *wq, struct work *w)
+{
+	int s;
+
+	assert(wq != NULL);
+	assert(w->w_func != NULL);
+
+	s = splhigh();
+	if (w->w_queued) {
+		splx(s);
+		return 0;
+	}
+
+	w->w_queued = 1;
+	w->w_next = NULL;
+	if (wq->wq_tail != NULL) {
+		wq->wq_tail->w_next = w;
+	}
+	else {
+		wq->wq_head = w;
+	}
+	wq->wq_tail = w;
+
+	wq->wq_posts++;
+	wq->wq_len++;
+	if (wq->wq_len > wq->wq_maxlen) {
+		wq->wq_maxlen = wq->wq_len;
+	}
+
+	thread_wakeup(wq);
+	splx(s);
+	return 1;
+}
+
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	int s;
+
+	s = splhigh();
+	kprintf("%-16s %7s %10s %10s %7s %7s\n", "workqueue", "workers",
+		"posts", "runs", "queued", "maxlen");
+	for (wq = allqueues; wq != NULL; wq = wq->wq_next) {
+		kprintf("%-16s %7d %10u %10u %7d %7d\n", wq->wq_name,
+			wq->wq_nworkers, wq->wq_posts, wq->wq_runs,
+			wq->wq_len, wq->wq_maxlen);
+	}
+	splx(s);
+}
+
+void
+workqueue_bootstrap(void)
+{
+	sys_workq = workqueue_create("sys_workq", SYS_WORKERS);
+	if (sys_workq == NULL) {
+		panic("workqueue_bootstrap: Could not start sys_workq\n");
+	}
+}
@@ -11,10 +11,22 @@
 #include <vfs.h>
 #include <vnode.h>
 #include <syscall.h>
+#include <objcache.h>
 #include "opt-A2.h"
 
 #if OPT_A2
 
+// Table entries come from here
+static struct objcache *file_objcache;
+
+void fdtable_bootstrap()
+{
+	file_objcache = objcache_create("file", sizeof(struct file), NULL);
+	if (file_objcache == NULL) {
+		panic("fdtable_bootstrap: Out of memory\n");
+	}
+}
+
 // Helper function to return the next available file descriptor
 
 int assign_fd()
@@ -45,7 +57,7 @@ int fdtable_open(char *name, int flags, int *retfd)
   	}
 
 	// Allocate the entry structure
-  	struct file *f = kmalloc(sizeof(struct file));
+  	struct file *f = objcache_alloc(file_objcache);
   	if (f == NULL)
 	{
     		return ENOMEM;
@@ -60,8 +72,7 @@ int fdtable_open(char *name, int flags, int *retfd)
   	int result = vfs_open(name, flags, &(f->file_vnode));
   	if (result)
 	{
-    		kfree(f->file_vnode);
-    		kfree(f);
+    		objcache_free(file_objcache, f);
     		return result;
   	}
 
@@ -94,7 +105,7 @@ int fdtable_close(int fd)
   	if (f->refcount == 0)
 	{
     		vfs_close(f->file_vnode);
-    		kfree(f);
+    		objcache_free(file_objcache, f);
     		curthread->t_process->t_fdtable->entries[fd] = NULL;
   	}
 
@@ -17,7 +17,9 @@
 #include <thread.h>
 #include <curthread.h>
 #include <vnode.h>
+#include "opt-A3.h"
 
+#if !OPT_A3
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -80,6 +82,7 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
 	
 	return result;
 }
+#endif
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -220,9 +223,22 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_A3
+		/*
+		 * Don't read anything now; vm_fault pages the segment
+		 * in from the file as it gets touched.
+		 */
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+		result = as_define_file(curthread->t_vmspace, v, ph.p_offset,
+					ph.p_vaddr, ph.p_filesz);
+#else
 		result = load_segment(v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
@@ -10,6 +10,7 @@
 #include <thread.h>
 #include <curthread.h>
 #include <clock.h>
+#include <scheduler.h>
 #include <syscall.h>
 #include <machine/trapframe.h>
 #include <addrspace.h>
@@ -18,6 +19,7 @@
 #include <vfs.h>
 #include <test.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 
@@ -45,7 +47,16 @@ int sys__exit(int exitcode)
 	lock_acquire(proctable_lock);
 	struct cv *waitpid_cv = curthread->t_process->waitpid_cv;
 	
+	// Record the CPU usage for whoever waits for us
+	thread_addusage(&curthread->t_process->usage);
+
 	fdtable_destroy();
+
+	// Wake everyone in waitpid for us. They can't run until we let go of
+	// proctable_lock, by which time we're marked as exited. This has to
+	// come first, because removing the process destroys the CV.
+	cv_broadcast(waitpid_cv, proctable_lock);
+
 	if (curthread->t_process->parent == NULL) {
 		(void)exitcode;
 		int result = proctable_remove_process(curthread->t_process->pid);
@@ -57,9 +68,6 @@ int sys__exit(int exitcode)
 		(void)result;
 	}
 
-	// Notify the waiting threads that this process has exited
-	cv_signal(waitpid_cv, proctable_lock);
-	cv_destroy(waitpid_cv);
 	lock_release(proctable_lock);
   	thread_exit(); // When thread exits, make sure it DOESN'T kfree the process, because it may still be needed. Instead, kfree the process in the process table
 	return 0;
@@ -174,6 +182,7 @@ void start_child(void * data1, unsigned long unused) {
 	}
 	info->child_pid = new_process->pid;
 	new_process->parent = info->parent->t_process;
+	new_process->tickets = info->parent->t_process->tickets;
 
 	// Attach new process to our thread
 	curthread->t_process = new_process;
@@ -342,4 +351,41 @@ int sys_execv(userptr_t program, userptr_t args)
 	*/
 }
 
+/*
+ * Set the calling process's CPU share (stride scheduler tickets) to
+ * TICKETS, or just look at it if TICKETS is 0. Returns the old share.
+ */
+int sys_setshare(int tickets, int *retval)
+{
+	struct process *p = curthread->t_process;
+
+	if (tickets < 0 || tickets > SCHED_MAXTICKETS) {
+		return EINVAL;
+	}
+	*retval = p->tickets;
+	if (tickets > 0) {
+		p->tickets = tickets;
+		scheduler_set_tickets(curthread, tickets);
+	}
+	return 0;
+}
+
 #endif /* OPT_A2 */
+
+#if OPT_A3
+/*
+ * Move the end of the heap by AMOUNT bytes. Returns the old break.
+ */
+int sys_sbrk(int amount, int *retval)
+{
+	vaddr_t oldbreak;
+	int result;
+
+	result = as_sbrk(curthread->t_vmspace, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int)oldbreak;
+	return 0;
+}
+#endif /* OPT_A3 */
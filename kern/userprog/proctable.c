@@ -3,6 +3,9 @@
 #include <proctable.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <scheduler.h>
+#include <workqueue.h>
+#include <objcache.h>
 
 #if OPT_A2
 
@@ -10,6 +13,18 @@
 // An array that contains pointers to processes, where the index is the pid of the process.
 static struct process **proctable;
 
+// Guards the slots of the table. Lookups take it shared; anything that
+// adds, removes or changes the state of processes takes it exclusively.
+static struct rwlock *proctable_rwlock;
+
+static int proctable_remove_locked(pid_t pid);
+
+// Reaps exited processes on sys_workq
+static struct work reap_work;
+
+// Process structures come from here
+static struct objcache *process_objcache;
+
 // "Private" helper functions
 void decouple_parent_from_children(struct process *parent)
 {
@@ -35,17 +50,58 @@ void clean_exited_processes()
 			if (proctable[i]->parent == NULL || proctable[i]->parent->status == exited) {
 				// The parent has either finished running, or has exited 
 				// Either way, it cannot request waitpid from its child, so remove it
-				proctable_remove_process(proctable[i]->pid);
+				proctable_remove_locked(proctable[i]->pid);
 			}
 		}
 	}
 }
 
+// Work function for reap_work: clear out exited processes nobody can
+// wait for any more. Takes proctable_lock too, so it can't pull a
+// process out from under waitpid.
+static void proctable_reap(void *unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+
+	lock_acquire(proctable_lock);
+	rwlock_acquire_write(proctable_rwlock);
+	clean_exited_processes();
+	rwlock_release_write(proctable_rwlock);
+	lock_release(proctable_lock);
+}
+
+// Find a free pid, or return 0 if there is none. The table is usually
+// kept clear by the reaper. If it's full, don't reap here: we only hold
+// proctable_rwlock, and reaping without proctable_lock could free a
+// process waitpid is looking at. Kick the reaper and fail instead.
+static pid_t proctable_alloc_pid()
+{
+	int i;
+
+	for (i = PROC_MIN; i < PROC_MAX; i++) {
+		if (proctable[i] == NULL) {
+			return i;
+		}
+	}
+
+	workqueue_post(sys_workq, &reap_work);
+	return 0;
+}
+
 // Initialize the process table
 void proctable_bootstrap()
 {
 	proctable = kmalloc(sizeof(struct process*) * PROC_MAX); // This is an array of pointers to struct processes
 	proctable_lock = lock_create("proctable lock");
+	proctable_rwlock = rwlock_create("proctable");
+	process_objcache = objcache_create("process", sizeof(struct process),
+					   NULL);
+	if (proctable_lock == NULL || proctable_rwlock == NULL ||
+	    process_objcache == NULL) {
+		panic("proctable_bootstrap: Out of memory\n");
+	}
+	work_init(&reap_work, proctable_reap, NULL, 0);
 
 	int i;
 	for (i = PROC_MIN; i < PROC_MAX; i++) {
@@ -56,32 +112,34 @@ void proctable_bootstrap()
 // Add a new process with no parent
 struct process *proctable_add_root_process() 
 {
-	// Before we add a new process, we should try and clean up the old processes
-	clean_exited_processes();
+	rwlock_acquire_write(proctable_rwlock);
 
 	// Allocate a new pid
-	pid_t pid = 0;
-	int i;
-	for (i = PROC_MIN; pid < PROC_MAX; i++) {
-		if (proctable[i] == NULL) {
-			pid = i;
-			break;
-		}
-	}
+	pid_t pid = proctable_alloc_pid();
 
 	// Return an error if all pids are taken
-	if (pid == 0) return NULL;
+	if (pid == 0) {
+		rwlock_release_write(proctable_rwlock);
+		return NULL;
+	}
 
 	// We have a pid, so we create a new process that will match it
-	struct process *new_process = kmalloc(sizeof(struct process));
+	struct process *new_process = objcache_alloc(process_objcache);
+	if (new_process == NULL) {
+		rwlock_release_write(proctable_rwlock);
+		return NULL;
+	}
 	new_process->pid = pid;
 	new_process->status = STATUS_RUNNING;
 	new_process->parent = NULL;
+	new_process->tickets = SCHED_DEFTICKETS;
+	bzero(&new_process->usage, sizeof(new_process->usage));
 	new_process->t_fdtable = NULL;
 	new_process->waitpid_cv = cv_create("waitpid cv");
 	new_process->t_fdtable_lock = lock_create("file table lock");
 
 	proctable[pid] = new_process;
+	rwlock_release_write(proctable_rwlock);
 	return new_process;
 }
 
@@ -89,47 +147,71 @@ struct process *proctable_add_root_process()
 // This is called from fork
 struct process *proctable_add_child_process(struct process *parent) 
 {
-	// Before we add a new process, we should try and clean up the old processes
-	clean_exited_processes();
+	rwlock_acquire_write(proctable_rwlock);
 
 	// Allocate a new pid
-	pid_t pid = 0;
-	int i;
-	for (i = PROC_MIN; pid < PROC_MAX; i++) {
-		if (proctable[i] == NULL) {
-			pid = i;
-			break;
-		}
-	}
+	pid_t pid = proctable_alloc_pid();
 
 	// Fail if no PIDs were found
-	if (pid == 0) return NULL;
+	if (pid == 0) {
+		rwlock_release_write(proctable_rwlock);
+		return NULL;
+	}
 
 	// We have a pid, so we create a new process that will match it
-	struct process *new_process = kmalloc(sizeof(struct process));
+	struct process *new_process = objcache_alloc(process_objcache);
+	if (new_process == NULL) {
+		rwlock_release_write(proctable_rwlock);
+		return NULL;
+	}
 	new_process->pid = pid;
 	new_process->status = STATUS_RUNNING;
 	new_process->parent = parent;
+	new_process->tickets = SCHED_DEFTICKETS;
+	bzero(&new_process->usage, sizeof(new_process->usage));
 	new_process->t_fdtable = NULL;
 	new_process->waitpid_cv = cv_create("waitpid cv");
 	new_process->t_fdtable_lock = lock_create("file table lock");
 
 	proctable[pid] = new_process;
+	rwlock_release_write(proctable_rwlock);
 	return new_process;
 }
 
 // Remove the process from the process table entirely
 int proctable_remove_process(pid_t pid)
 {
+	int result;
+
+	rwlock_acquire_write(proctable_rwlock);
+	result = proctable_remove_locked(pid);
+	rwlock_release_write(proctable_rwlock);
+
+	// Any of its children that have exited can go now
+	if (result == 0) {
+		workqueue_post(sys_workq, &reap_work);
+	}
+	return result;
+}
+
+// The same, with proctable_rwlock already held for writing
+static int proctable_remove_locked(pid_t pid)
+{
+	assert(rwlock_do_i_hold_write(proctable_rwlock));
+
 	if (!(pid >= PROC_MIN && pid <= PROC_MAX) || proctable[pid] == NULL) {
 		return EINVAL;
 	}
 
 	struct process *process_to_kill = proctable[pid];
 
+	// Its children can't be waited for any more
+	decouple_parent_from_children(process_to_kill);
+
 	// Deallocate all memory that was allocated with kmalloc
 	lock_destroy(process_to_kill->t_fdtable_lock);
-	kfree(process_to_kill);
+	cv_destroy(process_to_kill->waitpid_cv);
+	objcache_free(process_objcache, process_to_kill);
 
 	// Release the PID
 	proctable[pid] = NULL;
@@ -139,7 +221,9 @@ int proctable_remove_process(pid_t pid)
 // Set the process as "exited", but leave it in memory
 int proctable_set_process_exited(pid_t pid, int exitcode)
 {
+	rwlock_acquire_write(proctable_rwlock);
 	if (!(pid >= PROC_MIN && pid <= PROC_MAX) || proctable[pid] == NULL) {
+		rwlock_release_write(proctable_rwlock);
 		return EINVAL;
 	}
 
@@ -148,6 +232,10 @@ int proctable_set_process_exited(pid_t pid, int exitcode)
 	process_to_exit->exit_code = exitcode;
 	process_to_exit->status = STATUS_EXITED;
 	decouple_parent_from_children(process_to_exit);
+	rwlock_release_write(proctable_rwlock);
+
+	// Reap it, if its parent is gone, and any children that exited
+	workqueue_post(sys_workq, &reap_work);
 	return 0;
 }
 
@@ -155,11 +243,46 @@ int proctable_set_process_exited(pid_t pid, int exitcode)
 // Return NULL if process does not exist
 struct process* proctable_get_process(pid_t pid)
 {
+	struct process *p;
+
 	if (!(pid >= PROC_MIN && pid <= PROC_MAX)) {
 		return NULL;
 	}
 
-	return proctable[pid]; // This returns either NULL (if there is no process) or the pointer to the process itself
+	rwlock_acquire_read(proctable_rwlock);
+	p = proctable[pid]; // This is either NULL (if there is no process) or the pointer to the process itself
+	rwlock_release_read(proctable_rwlock);
+	return p;
+}
+
+// Print the CPU usage of processes that have exited but not been reaped
+// (live ones are shown with their threads)
+void proctable_printusage()
+{
+	int i, any = 0;
+	int exited = STATUS_EXITED;
+
+	rwlock_acquire_read(proctable_rwlock);
+	for (i = PROC_MIN; i < PROC_MAX; i++) {
+		struct process *p = proctable[i];
+		if (p == NULL || p->status != exited) {
+			continue;
+		}
+		if (!any) {
+			kprintf("%-16s %4s %8s %9s %9s %7s %7s\n", "exited",
+				"pid", "ticks", "run ms", "sleep ms", "vcsw",
+				"ivcsw");
+			any = 1;
+		}
+		kprintf("%-16s %4d %8u %9lu %9lu %7u %7u\n", "", p->pid,
+			p->usage.cu_ticks,
+			(unsigned long)p->usage.cu_runsecs * 1000 +
+			p->usage.cu_runnsecs / 1000000,
+			(unsigned long)p->usage.cu_sleepsecs * 1000 +
+			p->usage.cu_sleepnsecs / 1000000,
+			p->usage.cu_nvcsw, p->usage.cu_nivcsw);
+	}
+	rwlock_release_read(proctable_rwlock);
 }
 
 #endif /* OPT_A2 */
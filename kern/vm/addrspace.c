@@ -1,13 +1,18 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <uio.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 #include <vmstats.h>
-#include <array.h>
 #include <coremap.h>
+#include <thread.h>
+#include <curthread.h>
+#include <swap.h>
+#include <vmtlb.h>
 #include "opt-A3.h"
 
 #if OPT_A3
@@ -15,54 +20,162 @@
 struct addrspace *
 as_create(void)
 {
+	int i;
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
 	if (as==NULL) {
 		return NULL;
 	}
 
 	as->as_vbase1 = 0;
-	as->as_pbase1 = 0;
 	as->as_npages1 = 0;
 	as->as_vbase2 = 0;
-	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
-	as->as_stackpbase = 0;
 
-	as->pt = array_create();
+	as->as_heapbase = 0;
+	as->as_heaptop = 0;
+
+	as->as_asid = 0;
+	as->as_asid_gen = 0;
+
+	as->as_file = NULL;
+	as->as_fvaddr1 = 0;
+	as->as_foffset1 = 0;
+	as->as_fsize1 = 0;
+	as->as_fvaddr2 = 0;
+	as->as_foffset2 = 0;
+	as->as_fsize2 = 0;
+
+	as->as_pt = kmalloc(PT_DIR_ENTRIES * sizeof(pte_t *));
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	for (i = 0; i < (int)PT_DIR_ENTRIES; i++) {
+		as->as_pt[i] = NULL;
+	}
 
 	return as;
 }
 
-void
-as_destroy(struct addrspace *as)
+pte_t *
+as_lookup_pte(struct addrspace *as, vaddr_t vaddr, int create)
 {
-	array_destroy(as->pt);
-	kfree(as);
+	unsigned i;
+	pte_t *leaf;
+
+	assert(vaddr < USERTOP);
+
+	leaf = as->as_pt[PT_DIR_INDEX(vaddr)];
+	if (leaf == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		leaf = kmalloc(PAGE_SIZE);
+		if (leaf == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_LEAF_ENTRIES; i++) {
+			leaf[i] = 0;
+		}
+		as->as_pt[PT_DIR_INDEX(vaddr)] = leaf;
+	}
+
+	return &leaf[PT_LEAF_INDEX(vaddr)];
 }
 
+/*
+ * Give up the frame or swap slot behind PTE and take the page out of
+ * the address space.
+ */
+static
 void
-as_activate(struct addrspace *as)
+as_release_page(struct addrspace *as, pte_t *pte)
 {
-	int i, spl;
+	assert(curspl>0);
 
-	(void)as;
+	/* Let any page-out of this page finish first. */
+	while (*pte & PTE_BUSY) {
+		thread_sleep(pte);
+	}
+	if (*pte & PTE_VALID) {
+		coremap_unshare(PTE_FRAME(*pte), as);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	unsigned i, j;
+	pte_t *leaf;
+	int spl;
 
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	tlb_forget(as);
+
+	for (i = 0; i < PT_DIR_ENTRIES; i++) {
+		leaf = as->as_pt[i];
+		if (leaf == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_LEAF_ENTRIES; j++) {
+			as_release_page(as, &leaf[j]);
+		}
+		kfree(leaf);
+	}
+
+	splx(spl);
+
+	if (as->as_file != NULL) {
+		VOP_DECREF(as->as_file);
 	}
+	kfree(as->as_pt);
+	kfree(as);
+}
 
-	_vmstats_inc(VMSTAT_TLB_INVALIDATE);
+void
+as_activate(struct addrspace *as)
+{
+	int spl;
 
+	spl = splhigh();
+	tlb_activate(as);
 	splx(spl);
 }
 
+/*
+ * Mark NPAGES pages starting at VADDR as part of the address space
+ * with permissions FLAGS. No frames are allocated; vm_fault does that
+ * on first touch.
+ */
+static
+int
+as_define_pages(struct addrspace *as, vaddr_t vaddr, size_t npages,
+		pte_t flags)
+{
+	size_t i;
+	pte_t *pte;
+
+	for (i = 0; i < npages; i++) {
+		pte = as_lookup_pte(as, vaddr + i * PAGE_SIZE, 1);
+		if (pte == NULL) {
+			return ENOMEM;
+		}
+		*pte |= flags;
+	}
+	return 0;
+}
+
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
 	size_t npages; 
+	int result;
 
 	/* Align the region. First, the base... */
 	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -73,16 +186,23 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	unsigned int i;
-	struct pte * e;
+	/* Nothing else checks the addresses now that we don't uiomove. */
+	if (vaddr >= USERTOP || npages > (USERTOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+
+	if (as->as_vbase1 != 0 && as->as_vbase2 != 0) {
+		/*
+		 * Support for more than two regions is not available.
+		 */
+		kprintf("dumbvm: Warning: too many regions\n");
+		return EUNIMP;
+	}
 
-	for (i = 0; i < npages; i++)
-	{
-		e = kmalloc(sizeof(struct pte));
-		e->vaddr = vaddr + i * PAGE_SIZE;
-		e->flags = readable | writeable | executable;
-		e->valid = 0;
-		array_add(as->pt, e);
+	result = as_define_pages(as, vaddr, npages,
+				 (readable | writeable | executable) & PTE_PERMS);
+	if (result) {
+		return result;
 	}
 
 	if (as->as_vbase1 == 0) {
@@ -91,164 +211,333 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		return 0;
 	}
 
-	if (as->as_vbase2 == 0) {
-		as->as_vbase2 = vaddr;
-		as->as_npages2 = npages;
-		return 0;
-	}
-
-	/*
-	 * Support for more than two regions is not available.
-	 */
-	kprintf("dumbvm: Warning: too many regions\n");
-	return EUNIMP;
+	as->as_vbase2 = vaddr;
+	as->as_npages2 = npages;
+	return 0;
 }
 
 int
-as_prepare_load(struct addrspace *as)
+as_define_file(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t filesize)
 {
-	assert(as->as_pbase1 == 0);
-	assert(as->as_pbase2 == 0);
-	assert(as->as_stackpbase == 0);
+	vaddr_t va;
+	pte_t *pte;
 
-/* DONT ALLOCATE PHYSICAL MEMORY RIGHT AWAY
+	if (filesize == 0) {
+		return 0;
+	}
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
-		return ENOMEM;
+	if (as->as_fsize1 == 0) {
+		as->as_fvaddr1 = vaddr;
+		as->as_foffset1 = offset;
+		as->as_fsize1 = filesize;
+	}
+	else if (as->as_fsize2 == 0) {
+		as->as_fvaddr2 = vaddr;
+		as->as_foffset2 = offset;
+		as->as_fsize2 = filesize;
+	}
+	else {
+		kprintf("dumbvm: Warning: too many regions\n");
+		return EUNIMP;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
-		return ENOMEM;
+	if (as->as_file == NULL) {
+		VOP_INCREF(v);
+		as->as_file = v;
 	}
+	assert(as->as_file == v);
+
+	for (va = vaddr & PAGE_FRAME; va < vaddr + filesize; va += PAGE_SIZE) {
+		pte = as_lookup_pte(as, va, 0);
+		if (pte == NULL || *pte == 0) {
+			/* Contents outside their region. */
+			return ENOEXEC;
+		}
+		*pte |= PTE_FILE;
+	}
+	return 0;
+}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (as->as_stackpbase == 0) {
-		return ENOMEM;
+/*
+ * Read the part of the file contents [FVADDR, FVADDR+FSIZE) at file
+ * offset FOFFSET that falls in the page at VADDR into KPAGE.
+ */
+static
+int
+as_read_contents(struct vnode *v, vaddr_t vaddr, char *kpage,
+		 vaddr_t fvaddr, off_t foffset, size_t fsize)
+{
+	vaddr_t start, end;
+	struct uio ku;
+	int result;
+
+	start = vaddr > fvaddr ? vaddr : fvaddr;
+	end = vaddr + PAGE_SIZE < fvaddr + fsize ? vaddr + PAGE_SIZE
+		: fvaddr + fsize;
+	if (fsize == 0 || start >= end) {
+		return 0;
+	}
+
+	mk_kuio(&ku, kpage + (start - vaddr), end - start,
+		foffset + (start - fvaddr), UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
 	}
+	if (ku.uio_resid != 0) {
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+int
+as_load_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	char *kpage = (char *)PADDR_TO_KVADDR(paddr);
+	int result;
+
+	assert(as->as_file != NULL);
+	vaddr &= PAGE_FRAME;
+
+	bzero(kpage, PAGE_SIZE);
 
-*/
+	result = as_read_contents(as->as_file, vaddr, kpage, as->as_fvaddr1,
+				  as->as_foffset1, as->as_fsize1);
+	if (result) {
+		return result;
+	}
+	return as_read_contents(as->as_file, vaddr, kpage, as->as_fvaddr2,
+				as->as_foffset2, as->as_fsize2);
+}
 
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Frames are allocated on demand in vm_fault. */
+	(void)as;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	(void)as;
+	vaddr_t end1, end2;
+
+	/* The heap starts out empty, just past the highest region. */
+	end1 = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+	end2 = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+	as->as_heapbase = end1 > end2 ? end1 : end2;
+	as->as_heaptop = as->as_heapbase;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	//assert(as->as_stackpbase != 0);
-
-	struct pte * e;
-	int i;
+	int result;
 
-	for (i = 0; i < DUMBVM_STACKPAGES; i++)
-	{
-		e = kmalloc(sizeof(struct pte));
-		e->vaddr = USERSTACK - i * PAGE_SIZE;
-		e->flags = 0x7;
-		e->valid = 0;
-		array_add(as->pt, e);
+	result = as_define_pages(as, USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE,
+				 DUMBVM_STACKPAGES, PTE_PERMS);
+	if (result) {
+		return result;
 	}
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
-int
-as_copy(struct addrspace *old, struct addrspace **ret)
+/*
+ * Take the heap pages from START up to END out of the address space.
+ */
+static
+void
+as_release_heap(struct addrspace *as, vaddr_t start, vaddr_t end)
 {
-	struct addrspace *new;
+	vaddr_t va;
+	pte_t *pte;
 
-	new = as_create();
-	if (new==NULL) {
-		return ENOMEM;
-	}
+	assert(curspl>0);
 
-	new->as_vbase1 = old->as_vbase1;
-	new->as_npages1 = old->as_npages1;
-	new->as_vbase2 = old->as_vbase2;
-	new->as_npages2 = old->as_npages2;
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = as_lookup_pte(as, va, 0);
+		if (pte != NULL) {
+			as_release_page(as, pte);
+			tlb_invalidate_page(as, va);
+		}
+	}
+}
 
-	unsigned int i;
-	struct pte * e;
+int
+as_sbrk(struct addrspace *as, int amount, vaddr_t *oldbreak)
+{
+	vaddr_t oldtop, newtop, limit;
+	vaddr_t oldpage, newpage;
+	int spl, result;
+
+	oldtop = as->as_heaptop;
+	newtop = oldtop + amount;
+	if (amount < 0 ? newtop > oldtop : newtop < oldtop) {
+		/* Wrapped around. */
+		return amount < 0 ? EINVAL : ENOMEM;
+	}
+	if (newtop < as->as_heapbase) {
+		return EINVAL;
+	}
 
-	new->as_pbase1 = getppages(new->as_npages1);
-	if (new->as_pbase1 == 0) {
+	/*
+	 * Stay clear of the stack, and don't promise more pages than
+	 * there are frames and swap slots to hold them.
+	 */
+	limit = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	if (newtop > limit ||
+	    (newtop - as->as_heapbase) / PAGE_SIZE > vm_maxpages()) {
 		return ENOMEM;
 	}
 
-	assert(new->as_pbase1 != 0);
+	oldpage = (oldtop + PAGE_SIZE - 1) & PAGE_FRAME;
+	newpage = (newtop + PAGE_SIZE - 1) & PAGE_FRAME;
 
-	for (i = 0; i < new->as_npages1; i++)
-	{
-		e = kmalloc(sizeof(struct pte));
-		e->vaddr = new->as_vbase1 + i * PAGE_SIZE;
-		e->paddr = new->as_pbase1 + i * PAGE_SIZE;
-		e->valid = 1;
-		e->flags = 0x5;
-		array_add(new->pt, e);
+	spl = splhigh();
+	if (newpage > oldpage) {
+		/* Frames come later, from vm_fault. */
+		result = as_define_pages(as, oldpage,
+					 (newpage - oldpage) / PAGE_SIZE,
+					 PTE_READ | PTE_WRITE);
+		if (result) {
+			as_release_heap(as, oldpage, newpage);
+			splx(spl);
+			return result;
+		}
+	}
+	else if (newpage < oldpage) {
+		as_release_heap(as, newpage, oldpage);
 	}
+	splx(spl);
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
+	as->as_heaptop = newtop;
+	*oldbreak = oldtop;
+	return 0;
+}
 
-	new->as_pbase2 = getppages(new->as_npages2);
-	if (new->as_pbase2 == 0) {
-		return ENOMEM;
+/*
+ * Give the child the page behind OLDPTE at VADDR. A resident page is
+ * shared copy-on-write: both entries point at the same frame, and
+ * whichever process writes to it first gets its own copy in vm_fault.
+ * The parent (OLD) may have a writable TLB entry for the page, so that
+ * entry is thrown away to make it fault on its next write.
+ * A swapped-out page is read back into a new frame for the child; the
+ * parent's entry is held busy meanwhile so it can't change under us
+ * while we sleep.
+ */
+static
+int
+as_copy_page(struct addrspace *old, struct addrspace *new, vaddr_t vaddr,
+	     pte_t *oldpte, pte_t *newpte)
+{
+	paddr_t paddr;
+	int result = 0;
+
+	assert(curspl>0);
+
+	while (*oldpte & PTE_BUSY) {
+		thread_sleep(oldpte);
 	}
+	if ((*oldpte & (PTE_VALID | PTE_SWAPPED)) == 0) {
+		/* Not touched yet; the child faults it in on its own. */
+		*newpte = *oldpte;
+		return 0;
+	}
+	if (*oldpte & PTE_VALID) {
+		coremap_share(PTE_FRAME(*oldpte));
+		*newpte = *oldpte;
+		tlb_invalidate_page(old, vaddr);
+		return 0;
+	}
+
+	*oldpte |= PTE_BUSY;
 
-	assert(new->as_pbase2 != 0);
+	paddr = getuserpage(new, vaddr);
+	if (paddr == 0) {
+		result = ENOMEM;
+		goto done;
+	}
 
-	for (i = 0; i < new->as_npages2; i++)
-	{
-		e = kmalloc(sizeof(struct pte));
-		e->vaddr = new->as_vbase2 + i * PAGE_SIZE;
-		e->paddr = new->as_pbase2 + i * PAGE_SIZE;
-		e->valid = 1;
-		e->flags = 0x6;
-		array_add(new->pt, e);
+	result = swap_in(PTE_SLOT(*oldpte), paddr);
+	if (result) {
+		releasepages(paddr);
+		goto done;
 	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	*newpte = paddr | (PTE_FLAGS(*oldpte) & PTE_PERMS) | PTE_VALID;
+	coremap_unpin(paddr);
 
-	new->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (new->as_stackpbase == 0) {
+ done:
+	*oldpte &= ~PTE_BUSY;
+	thread_wakeup(oldpte);
+	return result;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	unsigned i, j;
+	pte_t *oldleaf, *newleaf;
+	int spl, result;
+
+	new = as_create();
+	if (new==NULL) {
 		return ENOMEM;
 	}
 
-	assert(new->as_stackpbase != 0);
+	new->as_vbase1 = old->as_vbase1;
+	new->as_npages1 = old->as_npages1;
+	new->as_vbase2 = old->as_vbase2;
+	new->as_npages2 = old->as_npages2;
+	new->as_heapbase = old->as_heapbase;
+	new->as_heaptop = old->as_heaptop;
 
-	for (i = 0; i < DUMBVM_STACKPAGES; i++)
-	{
-		e = kmalloc(sizeof(struct pte));
-		e->vaddr = USERSTACK - i * PAGE_SIZE;
-		e->paddr = new->as_stackpbase + i * PAGE_SIZE;
-		e->valid = 1;
-		e->flags = 0x7;
-		array_add(new->pt, e);
+	if (old->as_file != NULL) {
+		VOP_INCREF(old->as_file);
+		new->as_file = old->as_file;
 	}
+	new->as_fvaddr1 = old->as_fvaddr1;
+	new->as_foffset1 = old->as_foffset1;
+	new->as_fsize1 = old->as_fsize1;
+	new->as_fvaddr2 = old->as_fvaddr2;
+	new->as_foffset2 = old->as_foffset2;
+	new->as_fsize2 = old->as_fsize2;
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
-		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
-		DUMBVM_STACKPAGES*PAGE_SIZE);
-	
-	/*
-	for (i = 0; i < array_getnum(new->pt); i++)
-	{
-		e = (struct pte *) array_getguy(new->pt, i);
-		DEBUG(DB_VM, "PT(%d) V 0x%x P 0x%x\n", i+1, e->vaddr, e->paddr);
+	spl = splhigh();
+
+	for (i = 0; i < PT_DIR_ENTRIES; i++) {
+		oldleaf = old->as_pt[i];
+		if (oldleaf == NULL) {
+			continue;
+		}
+
+		newleaf = as_lookup_pte(new, i << PT_DIR_SHIFT, 1);
+		if (newleaf == NULL) {
+			splx(spl);
+			as_destroy(new);
+			return ENOMEM;
+		}
+
+		for (j = 0; j < PT_LEAF_ENTRIES; j++) {
+			result = as_copy_page(old, new,
+				(i << PT_DIR_SHIFT) | (j << PT_LEAF_SHIFT),
+				&oldleaf[j], &newleaf[j]);
+			if (result) {
+				splx(spl);
+				as_destroy(new);
+				return result;
+			}
+		}
 	}
-	*/
+
+	splx(spl);
 
 	*ret = new;
 	return 0;
@@ -1,81 +1,703 @@
 #include <coremap.h>
 #include <curthread.h>
 #include <thread.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <addrspace.h>
+#include <swap.h>
+#include <vmstats.h>
+#include <machine/spl.h>
+#include <vmtlb.h>
 #if OPT_A3
 
-void initialize_coremap() 
+static struct coremap_entry *coremap;
+static int coremap_size;		/* number of managed frames */
+static paddr_t coremap_base;		/* physical address of frame 0 */
+static volatile int coremap_ready = 0;
+
+/* Head of the free list for each block order, -1 if empty */
+static int freelists[CM_MAX_ORDER + 1];
+
+static int coremap_nfree;		/* free frames */
+
+/* Page-out daemon: keeps coremap_nfree between these two marks. */
+static int pageout_low, pageout_high;
+static int pageout_running;
+
+/*
+ * User frames, oldest page-in first, linked through cm_next/cm_prev
+ * (which free frames use for the free lists).
+ */
+static int resident_head = -1, resident_tail = -1;
+
+#define CM_PADDR(i)	(coremap_base + (paddr_t)(i) * PAGE_SIZE)
+#define CM_INDEX(pa)	((int)(((pa) - coremap_base) / PAGE_SIZE))
+
+static
+void
+freelist_push(int i, int order)
+{
+	coremap[i].cm_state = CM_FREE;
+	coremap[i].cm_order = order;
+	coremap[i].cm_prev = -1;
+	coremap[i].cm_next = freelists[order];
+	if (freelists[order] >= 0) {
+		coremap[freelists[order]].cm_prev = i;
+	}
+	freelists[order] = i;
+}
+
+static
+void
+freelist_remove(int i)
+{
+	struct coremap_entry *e = &coremap[i];
+
+	assert(e->cm_state == CM_FREE);
+
+	if (e->cm_prev >= 0) {
+		coremap[e->cm_prev].cm_next = e->cm_next;
+	}
+	else {
+		freelists[e->cm_order] = e->cm_next;
+	}
+	if (e->cm_next >= 0) {
+		coremap[e->cm_next].cm_prev = e->cm_prev;
+	}
+	e->cm_state = CM_INNER;
+}
+
+/*
+ * Return the block of 2^ORDER frames at I to the free lists, merging
+ * it with its buddy for as long as the buddy is free and whole.
+ */
+static
+void
+free_block(int i, int order)
 {
-	u_int32_t firstpaddr = 0; // address of first free physical page 
-	u_int32_t lastpaddr = 0; // one past end of last free physical page
+	int buddy;
+
+	while (order < CM_MAX_ORDER) {
+		buddy = i ^ (1 << order);
+		if (buddy + (1 << order) > coremap_size ||
+		    coremap[buddy].cm_state != CM_FREE ||
+		    coremap[buddy].cm_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < i) {
+			coremap[i].cm_state = CM_INNER;
+			i = buddy;
+		}
+		order++;
+	}
+	freelist_push(i, order);
+}
+
+/*
+ * Free the frames [START, END) as a sequence of naturally aligned
+ * power-of-two blocks.
+ */
+static
+void
+free_range(int start, int end)
+{
+	int order;
+
+	while (start < end) {
+		order = 0;
+		while (order < CM_MAX_ORDER &&
+		       (start & (1 << order)) == 0 &&
+		       start + (2 << order) <= end) {
+			order++;
+		}
+		free_block(start, order);
+		start += 1 << order;
+	}
+}
+
+static
+void
+resident_append(int i)
+{
+	assert((coremap[i].cm_flags & CM_RESIDENT) == 0);
+
+	coremap[i].cm_flags |= CM_RESIDENT;
+	coremap[i].cm_next = -1;
+	coremap[i].cm_prev = resident_tail;
+	if (resident_tail >= 0) {
+		coremap[resident_tail].cm_next = i;
+	}
+	else {
+		resident_head = i;
+	}
+	resident_tail = i;
+}
+
+static
+void
+resident_remove(int i)
+{
+	struct coremap_entry *e = &coremap[i];
+
+	assert(e->cm_flags & CM_RESIDENT);
+
+	if (e->cm_prev >= 0) {
+		coremap[e->cm_prev].cm_next = e->cm_next;
+	}
+	else {
+		resident_head = e->cm_next;
+	}
+	if (e->cm_next >= 0) {
+		coremap[e->cm_next].cm_prev = e->cm_prev;
+	}
+	else {
+		resident_tail = e->cm_prev;
+	}
+	e->cm_next = e->cm_prev = -1;
+	e->cm_flags &= ~CM_RESIDENT;
+}
+
+void initialize_coremap(void)
+{
+	paddr_t firstpaddr, lastpaddr;
+	u_int32_t npages, mappages;
+	int i;
+
 	ram_getsize(&firstpaddr, &lastpaddr);
 
-	coremap_size = (lastpaddr-firstpaddr)/PAGE_SIZE;
-	coremap = kmalloc(sizeof(struct coremap_entry*) * coremap_size);
-	if (coremap == NULL) {
+	/* Steal enough pages to describe everything that's left. */
+	npages = (lastpaddr - firstpaddr) / PAGE_SIZE;
+	mappages = (npages * sizeof(struct coremap_entry) + PAGE_SIZE - 1)
+		/ PAGE_SIZE;
+	coremap_base = ram_stealmem(mappages);
+	if (coremap_base == 0) {
 		panic("\ncoremap: Unable to create\n");
 	}
-	
-	int i;
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(coremap_base);
+
+	/* Everything past the map itself is ours to manage. */
+	ram_getsize(&firstpaddr, &lastpaddr);
+	coremap_base = firstpaddr;
+	coremap_size = (lastpaddr - firstpaddr) / PAGE_SIZE;
+	assert((u_int32_t)coremap_size <= npages);
+
+	for (i = 0; i <= CM_MAX_ORDER; i++) {
+		freelists[i] = -1;
+	}
 	for (i = 0; i < coremap_size; i++) {
-		struct coremap_entry *entry = kmalloc(sizeof(struct coremap_entry));
-		entry->paddr = firstpaddr + (i * PAGE_SIZE);
-		entry->used = 0;
-		entry->block_len = -1;
-		coremap[i] = entry;
+		coremap[i].cm_next = -1;
+		coremap[i].cm_prev = -1;
+		coremap[i].cm_npages = 0;
+		coremap[i].cm_refcount = 0;
+		coremap[i].cm_order = 0;
+		coremap[i].cm_age = 0;
+		coremap[i].cm_state = CM_INNER;
+		coremap[i].cm_flags = 0;
+		coremap[i].cm_as = NULL;
+		coremap[i].cm_vaddr = 0;
 	}
-	
-	coremap_ready = 1;
-	
-	// Get the latest used ram
-	ram_getsize(&firstpaddr, &lastpaddr);
 
-	// "Fill up" the core map with the ram already used
-	for(i = 0; coremap[i]->paddr < firstpaddr; i++) {
-		coremap[i]->used = 1;
+	free_range(0, coremap_size);
+	coremap_nfree = coremap_size;
+
+	pageout_low = coremap_size / 64;
+	if (pageout_low < 4) {
+		pageout_low = 4;
 	}
+	pageout_high = 2 * pageout_low;
+
+	coremap_ready = 1;
 
-	kprintf("INITIALIZE COREMAP: %d %d\n", firstpaddr, coremap_size);
+	kprintf("coremap: %d frames at 0x%x (%u pages of map)\n",
+		coremap_size, coremap_base, mappages);
+}
+
+int
+coremap_nframes(void)
+{
+	return coremap_size;
 }
 
 paddr_t getppages(unsigned long npages)
 {
+	int spl;
+	int order, o, i;
+
 	if (coremap_ready == 0)
 		return ram_stealmem(npages);
 
-	int i, j;
-	unsigned int count = 0;
-	for (i = 0; i < coremap_size; i++) {
-		if (coremap[i]->used) {
-			count = 0;
-		} else {
-			count++;
+	assert(npages > 0);
+
+	for (order = 0; (1UL << order) < npages; order++);
+	if (order > CM_MAX_ORDER) {
+		return 0;
+	}
+
+	spl = splhigh();
+
+	/* Fast path: a single free page. */
+	if (order == 0 && freelists[0] >= 0) {
+		i = freelists[0];
+		freelist_remove(i);
+	}
+	else {
+		for (o = order; o <= CM_MAX_ORDER && freelists[o] < 0; o++);
+		if (o > CM_MAX_ORDER) {
+			splx(spl);
+			return 0; // We never found a contiguous memory block
 		}
-		if (count == npages) {
-			coremap[i - npages + 1]->block_len = npages;
-			for (j = i - npages + 1; j <= i; j++) {
-				coremap[j]->used = 1;
-			}
+		i = freelists[o];
+		freelist_remove(i);
 
-			return coremap[i - npages + 1]->paddr;
+		/* Split off the upper halves until we're at the right size. */
+		while (o > order) {
+			o--;
+			freelist_push(i + (1 << o), o);
 		}
+
+		/* Give back the part of the block beyond npages. */
+		free_range(i + npages, i + (1 << order));
 	}
-	return 0; // We never found a contiguous memory block
+
+	coremap[i].cm_state = CM_USED;
+	coremap[i].cm_npages = npages;
+	coremap_nfree -= npages;
+
+	if (pageout_running && coremap_nfree < pageout_low) {
+		thread_wakeup(&pageout_running);
+	}
+
+	splx(spl);
+	return CM_PADDR(i);
 }
 
 
 void releasepages(paddr_t paddr)
 {
-	int i, j;
-	for (i = 0; coremap[i]->paddr != paddr; i++);
-	
-	assert(coremap[i]->block_len != -1);
-	
-	for (j = 0; j < coremap[i]->block_len; j++) {
-		coremap[j]->used = 0;
+	int spl;
+	int i, npages;
+
+	assert(coremap_ready);
+	assert(paddr >= coremap_base);
+
+	i = CM_INDEX(paddr);
+	assert(i < coremap_size);
+
+	spl = splhigh();
+
+	assert(coremap[i].cm_state == CM_USED);
+	if (coremap[i].cm_flags & CM_RESIDENT) {
+		resident_remove(i);
+	}
+	npages = coremap[i].cm_npages;
+	coremap[i].cm_state = CM_INNER;
+	coremap[i].cm_npages = 0;
+	coremap[i].cm_refcount = 0;
+	coremap[i].cm_flags = 0;
+	coremap[i].cm_as = NULL;
+	coremap[i].cm_vaddr = 0;
+
+	free_range(i, i + npages);
+	coremap_nfree += npages;
+
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Eviction.
+
+////////////////////////////////////////////////////////////
+//
+// Replacement policies.
+//
+// Each policy picks a victim from the resident list. They all see the
+// same information: the order pages came in, and the PTE_ACCESSED bit
+// that vm_fault sets whenever it loads a page into the TLB. Since the
+// hardware keeps no reference bits, a policy that looks at (and clears)
+// a page's bit also drops its TLB entry, so that the next use of the
+// page faults and sets the bit again.
+
+static int pp_fifo_victim(void);
+static int pp_clock_victim(void);
+static int pp_aging_victim(void);
+
+static struct pagepolicy {
+	const char *pp_name;
+	int (*pp_victim)(void);	/* frame to evict, or -1 */
+	unsigned pp_hits;	/* faults that found the page resident */
+	unsigned pp_misses;	/* faults that read the page from swap */
+	unsigned pp_evictions;
+	unsigned pp_spared;	/* pages FIFO would have taken but we kept */
+} pagepolicies[] = {
+	{ "fifo",	pp_fifo_victim,	 0, 0, 0, 0 },
+	{ "clock",	pp_clock_victim, 0, 0, 0, 0 },
+	{ "aging",	pp_aging_victim, 0, 0, 0, 0 },
+	{ NULL,		NULL,		 0, 0, 0, 0 },
+};
+
+static struct pagepolicy *pagepolicy = &pagepolicies[0];
+
+/*
+ * Can frame I be evicted right now? Frames shared copy-on-write,
+ * frames nobody owns, pinned frames and pages in transit can't.
+ */
+static
+int
+frame_evictable(int i)
+{
+	struct coremap_entry *e = &coremap[i];
+	pte_t *pte;
+
+	if (e->cm_state != CM_USED || e->cm_as == NULL ||
+	    e->cm_refcount > 1 || (e->cm_flags & CM_PINNED)) {
+		return 0;
+	}
+	pte = as_lookup_pte(e->cm_as, e->cm_vaddr, 0);
+	assert(pte != NULL);
+	return (*pte & PTE_BUSY) == 0;
+}
+
+/*
+ * Test and clear the accessed bit of the page in frame I.
+ */
+static
+int
+frame_accessed(int i)
+{
+	struct coremap_entry *e = &coremap[i];
+	pte_t *pte;
+
+	if (e->cm_as == NULL) {
+		return 0;
+	}
+	pte = as_lookup_pte(e->cm_as, e->cm_vaddr, 0);
+	assert(pte != NULL);
+	if ((*pte & PTE_ACCESSED) == 0) {
+		return 0;
+	}
+	*pte &= ~PTE_ACCESSED;
+	tlb_invalidate_page(e->cm_as, e->cm_vaddr);
+	return 1;
+}
+
+/* Oldest evictable page. */
+static
+int
+pp_fifo_victim(void)
+{
+	int i;
+
+	for (i = resident_head; i >= 0; i = coremap[i].cm_next) {
+		if (frame_evictable(i)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Second chance. Recently used pages at the head go to the back of
+ * the list instead of being evicted. After one lap every page has
+ * lost its bit, so this is bounded by twice the list length.
+ */
+static
+int
+pp_clock_victim(void)
+{
+	int i, next, n, nresident;
+
+	nresident = coremap_size - coremap_nfree;
+	i = resident_head;
+	for (n = 0; i >= 0 && n < 2 * nresident; n++) {
+		next = coremap[i].cm_next;
+		if (frame_evictable(i)) {
+			if (!frame_accessed(i)) {
+				return i;
+			}
+			pagepolicy->pp_spared++;
+			resident_remove(i);
+			resident_append(i);
+		}
+		i = next >= 0 ? next : resident_head;
+	}
+	return -1;
+}
+
+/*
+ * Aging. Each call shifts every page's age counter right, putting its
+ * accessed bit in at the top, and evicts the page with the lowest
+ * count (the oldest one, of those that tie).
+ */
+static
+int
+pp_aging_victim(void)
+{
+	int i, oldest = -1, victim = -1;
+
+	for (i = resident_head; i >= 0; i = coremap[i].cm_next) {
+		coremap[i].cm_age >>= 1;
+		if (frame_accessed(i)) {
+			coremap[i].cm_age |= 0x80;
+		}
+		if (!frame_evictable(i)) {
+			continue;
+		}
+		if (oldest < 0) {
+			oldest = i;
+		}
+		if (victim < 0 || coremap[i].cm_age < coremap[victim].cm_age) {
+			victim = i;
+		}
+	}
+	if (victim != oldest) {
+		/* FIFO would have taken the oldest page. */
+		pagepolicy->pp_spared++;
+	}
+	return victim;
+}
+
+int
+coremap_set_policy(const char *name)
+{
+	int i;
+
+	for (i = 0; pagepolicies[i].pp_name != NULL; i++) {
+		if (!strcmp(name, pagepolicies[i].pp_name)) {
+			pagepolicy = &pagepolicies[i];
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+coremap_policy_name(void)
+{
+	return pagepolicy->pp_name;
+}
+
+void
+coremap_count_fault(int resident)
+{
+	if (resident) {
+		pagepolicy->pp_hits++;
+	}
+	else {
+		pagepolicy->pp_misses++;
+	}
+}
+
+void
+coremap_printstats(void)
+{
+	struct pagepolicy *pp;
+
+	for (pp = pagepolicies; pp->pp_name != NULL; pp++) {
+		if (pp != pagepolicy && pp->pp_evictions == 0) {
+			continue;
+		}
+		kprintf("Page replacement %-5s: %u hits, %u misses, "
+			"%u evictions, %u spared\n", pp->pp_name,
+			pp->pp_hits, pp->pp_misses, pp->pp_evictions,
+			pp->pp_spared);
+	}
+}
+
+/*
+ * Write a user page out to swap and take its frame. The frame comes
+ * back pinned and no longer owned by anyone; returns 0 if nothing can
+ * be evicted. Sleeps during the write.
+ */
+static
+paddr_t
+coremap_evict(void)
+{
+	int i, result;
+	struct coremap_entry *e;
+	pte_t *pte;
+	paddr_t paddr;
+	u_int32_t slot;
+
+	assert(curspl>0);
+
+	i = pagepolicy->pp_victim();
+	if (i < 0) {
+		return 0;
+	}
+	if (swap_alloc(&slot)) {
+		return 0;
+	}
+
+	e = &coremap[i];
+	paddr = CM_PADDR(i);
+	pte = as_lookup_pte(e->cm_as, e->cm_vaddr, 0);
+	assert(pte != NULL && (*pte & PTE_VALID));
+	assert(PTE_FRAME(*pte) == paddr);
+
+	/* Keep everyone off the page while it's on its way out. */
+	e->cm_flags |= CM_PINNED;
+	*pte |= PTE_BUSY;
+	tlb_invalidate_page(e->cm_as, e->cm_vaddr);
+
+	result = swap_out(slot, paddr);
+	if (result) {
+		kprintf("swap: page-out failed: %s\n", strerror(result));
+		swap_free(slot);
+		*pte &= ~PTE_BUSY;
+		e->cm_flags &= ~CM_PINNED;
+		thread_wakeup(pte);
+		return 0;
+	}
+
+	*pte = MKPTE_SLOT(slot, PTE_FLAGS(*pte) & ~(PTE_BUSY | PTE_ACCESSED));
+	thread_wakeup(pte);
+	_vmstats_inc(VMSTAT_PAGE_OUT);
+	pagepolicy->pp_evictions++;
+
+	resident_remove(i);
+	e->cm_as = NULL;
+	e->cm_vaddr = 0;
+	return paddr;
+}
+
+paddr_t
+getuserpage(struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t paddr;
+	int i;
+
+	assert(curspl>0);
+
+	paddr = getppages(1);
+	if (paddr == 0 && swap_enabled()) {
+		paddr = coremap_evict();
+	}
+	if (paddr == 0) {
+		return 0;
+	}
+
+	i = CM_INDEX(paddr);
+	coremap[i].cm_as = as;
+	coremap[i].cm_vaddr = vaddr & PAGE_FRAME;
+	coremap[i].cm_refcount = 1;
+	coremap[i].cm_age = 0;
+	coremap[i].cm_flags |= CM_PINNED;
+	resident_append(i);
+	return paddr;
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	int i = CM_INDEX(paddr);
+
+	assert(i >= 0 && i < coremap_size);
+	assert(coremap[i].cm_flags & CM_PINNED);
+	coremap[i].cm_flags &= ~CM_PINNED;
+}
+
+void
+coremap_share(paddr_t paddr)
+{
+	int i = CM_INDEX(paddr);
+
+	assert(curspl>0);
+	assert(i >= 0 && i < coremap_size);
+	assert(coremap[i].cm_refcount > 0);
+	coremap[i].cm_refcount++;
+}
+
+void
+coremap_unshare(paddr_t paddr, struct addrspace *as)
+{
+	int i = CM_INDEX(paddr);
+	struct coremap_entry *e;
+
+	assert(curspl>0);
+	assert(i >= 0 && i < coremap_size);
+
+	e = &coremap[i];
+	assert(e->cm_refcount > 0);
+	if (--e->cm_refcount == 0) {
+		releasepages(paddr);
+		return;
+	}
+	if (e->cm_as == as) {
+		/* The remaining sharer adopts it in coremap_private. */
+		e->cm_as = NULL;
+		e->cm_vaddr = 0;
+	}
+}
+
+int
+coremap_private(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	int i = CM_INDEX(paddr);
+	struct coremap_entry *e;
+
+	assert(curspl>0);
+	assert(i >= 0 && i < coremap_size);
+
+	e = &coremap[i];
+	if (e->cm_refcount > 1) {
+		return 0;
+	}
+	e->cm_as = as;
+	e->cm_vaddr = vaddr & PAGE_FRAME;
+	return 1;
+}
+
+/*
+ * The page-out daemon. Sleeps until free memory drops below the low
+ * watermark, then evicts user pages until it's back above the high
+ * one, so that kmalloc (which can't wait for the disk) finds pages.
+ */
+static
+void
+pageout_thread(void *unused1, unsigned long unused2)
+{
+	paddr_t paddr;
+
+	(void)unused1;
+	(void)unused2;
+
+	thread_daemonize();
+
+	splhigh();
+	while (1) {
+		while (coremap_nfree >= pageout_low) {
+			thread_sleep(&pageout_running);
+		}
+		while (coremap_nfree < pageout_high) {
+			paddr = coremap_evict();
+			if (paddr == 0) {
+				/* Nothing evictable; try again in a second. */
+				thread_sleep(&lbolt);
+				break;
+			}
+			releasepages(paddr);
+			_vmstats_inc(VMSTAT_PAGE_OUT_DAEMON);
+		}
+	}
+}
+
+void
+pageout_bootstrap(void)
+{
+	int result;
+
+	if (!swap_enabled()) {
+		return;
+	}
+
+	result = thread_fork("pageout", NULL, 0, pageout_thread, NULL);
+	if (result) {
+		panic("coremap: Could not start page-out daemon: %s\n",
+		      strerror(result));
 	}
-	
-	coremap[i]->block_len = -1;
+	pageout_running = 1;
 }
 
 #endif
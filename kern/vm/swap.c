@@ -0,0 +1,128 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <machine/spl.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static u_int32_t swap_nslots;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, &swap_vnode);
+	if (result) {
+		kprintf("swap: no swap device %s (%s); swapping disabled\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: cannot stat %s: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Could not create slot bitmap\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+int
+swap_enabled(void)
+{
+	return swap_vnode != NULL && swap_nslots > 0;
+}
+
+u_int32_t
+swap_size(void)
+{
+	return swap_enabled() ? swap_nslots : 0;
+}
+
+int
+swap_alloc(u_int32_t *slot)
+{
+	assert(curspl>0);
+
+	if (!swap_enabled() || bitmap_alloc(swap_map, slot)) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void
+swap_free(u_int32_t slot)
+{
+	assert(curspl>0);
+	assert(slot < swap_nslots);
+
+	bitmap_unmark(swap_map, slot);
+}
+
+/*
+ * Move one page between the swap device and physical memory.
+ */
+static
+int
+swap_io(u_int32_t slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct uio ku;
+	int result;
+
+	assert(slot < swap_nslots);
+	assert(bitmap_isset(swap_map, slot));
+
+	mk_kuio(&ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		(off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("swap: short %s on slot %u\n",
+			rw == UIO_READ ? "read" : "write", slot);
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_in(u_int32_t slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_READ);
+}
+
+int
+swap_out(u_int32_t slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_WRITE);
+}
+
+#endif /* OPT_A3 */
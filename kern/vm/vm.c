@@ -9,9 +9,9 @@
 #include <machine/tlb.h>
 #include "opt-A3.h"
 #include <vmstats.h>
-#include <syscall.h>
-#include <array.h>
 #include <coremap.h>
+#include <swap.h>
+#include <vmtlb.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -24,40 +24,39 @@
 #define DUMBVM_STACKPAGES    12
 
 #if OPT_A3
-static unsigned int next_victim = 0;
+/*
+ * A page of zeros, mapped read-only for reads of anonymous pages
+ * (BSS, stack) that have never been written.
+ */
+static paddr_t vm_zeropage;
 #endif
 
 void
 vm_bootstrap(void)
 {
 	vmstats_init();
+	#if OPT_A3
+	vm_zeropage = getppages(1);
+	if (vm_zeropage == 0) {
+		panic("vm: Could not allocate the zero page\n");
+	}
+	bzero((void *)PADDR_TO_KVADDR(vm_zeropage), PAGE_SIZE);
+
+	swap_bootstrap();
+	pageout_bootstrap();
+	#endif
 }
 
 void
 vm_shutdown(void)
 {
+	#if OPT_A3
+	kprintf("TLB replacement policy: %s\n", tlb_policy_name());
+	coremap_printstats();
+	#endif
 	_vmstats_print();	
 }
 
-#if OPT_A3
-int tlb_get_rr_victim()
-{
-	int victim;
-
-	victim = next_victim % NUM_TLB;
-	if (next_victim < NUM_TLB)
-	{
-		_vmstats_inc(VMSTAT_TLB_FAULT_FREE);
-	}
-	else
-	{
-		_vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
-	}
-	next_victim++;
-	return victim;
-}
-#endif
-
 /*static*/
 /*paddr_t*/
 /*getppages(unsigned long npages)*/
@@ -73,6 +72,18 @@ int tlb_get_rr_victim()
 /*	return addr;*/
 /*}*/
 
+#if OPT_A3
+/*
+ * The most pages any one process could have: everything in memory
+ * plus everything in swap.
+ */
+u_int32_t
+vm_maxpages(void)
+{
+	return coremap_nframes() + swap_size();
+}
+#endif
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(int npages)
@@ -90,13 +101,116 @@ free_kpages(vaddr_t vaddr)
 	releasepages(KVADDR_TO_PADDR(vaddr));
 }
 
+#if OPT_A3
+/*
+ * Give the page at VADDR (whose entry is PTE, currently without a
+ * frame) a frame: read it back from swap if it was evicted, load it
+ * from the executable if it has never been touched, otherwise hand
+ * out a zeroed one. Returns the frame in RET. May sleep, so the
+ * entry is marked busy for the duration.
+ */
+static
+int
+vm_pagein(struct addrspace *as, vaddr_t vaddr, pte_t *pte, paddr_t *ret)
+{
+	paddr_t paddr;
+	int result;
+
+	assert(curspl>0);
+	assert((*pte & (PTE_VALID | PTE_BUSY)) == 0);
+
+	*pte |= PTE_BUSY;
+
+	paddr = getuserpage(as, vaddr);
+	if (paddr == 0) {
+		*pte &= ~PTE_BUSY;
+		thread_wakeup(pte);
+		return ENOMEM;
+	}
+
+	if (*pte & PTE_SWAPPED) {
+		result = swap_in(PTE_SLOT(*pte), paddr);
+		if (result) {
+			releasepages(paddr);
+			*pte &= ~PTE_BUSY;
+			thread_wakeup(pte);
+			return result;
+		}
+		swap_free(PTE_SLOT(*pte));
+		_vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		coremap_count_fault(0);
+	}
+	else if (*pte & PTE_FILE) {
+		result = as_load_page(as, vaddr, paddr);
+		if (result) {
+			releasepages(paddr);
+			*pte &= ~PTE_BUSY;
+			thread_wakeup(pte);
+			return result;
+		}
+		_vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		_vmstats_inc(VMSTAT_ELF_FILE_READ);
+	}
+	else {
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+		_vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+	}
+
+	*pte = paddr | (PTE_FLAGS(*pte) & ~(PTE_SWAPPED | PTE_FILE | PTE_BUSY))
+		| PTE_VALID;
+	coremap_unpin(paddr);
+	thread_wakeup(pte);
+
+	*ret = paddr;
+	return 0;
+}
+
+/*
+ * Write fault on a page shared copy-on-write: give AS its own copy of
+ * the frame behind PTE and drop its reference to the shared one.
+ */
+static
+int
+vm_copyonwrite(struct addrspace *as, vaddr_t vaddr, pte_t *pte,
+	       paddr_t *ret)
+{
+	paddr_t paddr, oldpaddr;
+
+	assert(curspl>0);
+	assert((*pte & (PTE_VALID | PTE_BUSY)) == PTE_VALID);
+
+	*pte |= PTE_BUSY;
+	oldpaddr = PTE_FRAME(*pte);
+
+	paddr = getuserpage(as, vaddr);
+	if (paddr == 0) {
+		*pte &= ~PTE_BUSY;
+		thread_wakeup(pte);
+		return ENOMEM;
+	}
+
+	memmove((void *)PADDR_TO_KVADDR(paddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+
+	*pte = paddr | (PTE_FLAGS(*pte) & ~PTE_BUSY);
+	coremap_unshare(oldpaddr, as);
+	coremap_unpin(paddr);
+	thread_wakeup(pte);
+	_vmstats_inc(VMSTAT_COW_FAULT);
+
+	*ret = paddr;
+	return 0;
+}
+#endif
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
+	#if !OPT_A3
 	int i;
 	u_int32_t ehi, elo;
+	#endif
 	struct addrspace *as;
 	int spl;
 
@@ -109,7 +223,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
 		#if OPT_A3
-		sys__exit(-1);
+		/* Copy-on-write; sorted out below. */
+		break;
 		#else
 		/* We always create pages read-write, so we can't get this */
 		panic("dumbvm: got VM_FAULT_READONLY\n");
@@ -129,69 +244,88 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 * fault early in boot. Return EFAULT so as to panic
 		 * instead of getting into an infinite faulting loop.
 		 */
+		splx(spl);
 		return EFAULT;
 	}
 
 	#if OPT_A3
-	struct pte * e;
-	for (i = 0; i < array_getnum(as->pt); i++)
-	{
-		e = (struct pte *) array_getguy(as->pt, i);
-
-		if (e->vaddr == faultaddress)
-		{
-			if(e->valid == 0)
-			{
-				_vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
-				paddr = getppages(1);
-				if (paddr == NULL)
-				{
-					return ENOMEM;
-				}
-				e->paddr = paddr;
-				e->valid = 1;
-
-				if (as->as_pbase1 == 0 && faultaddress >= as->as_vbase1 && faultaddress < as->as_vbase1 + as->as_npages1 * PAGE_SIZE)
-				{
-					as->as_pbase1 = paddr;
-				}
-				if (as->as_pbase2 == 0 && faultaddress >= as->as_vbase2 && faultaddress < as->as_vbase2 + as->as_npages2 * PAGE_SIZE)
-				{
-					as->as_pbase2 = paddr;
-				}
-				if (as->as_stackpbase == 0 && faultaddress >= USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE && faultaddress < USERSTACK)
-				{
-					as->as_stackpbase = paddr;
-				}
-				//DEBUG(DB_VM, "VM: Allocated 0x%x at physical address 0x%x\n", faultaddress, paddr);
+	pte_t *pte;
+	int writable;
+
+	if (faultaddress >= USERTOP) {
+		splx(spl);
+		return EFAULT;
+	}
+
+	pte = as_lookup_pte(as, faultaddress, 0);
+	if (pte == NULL || *pte == 0) {
+		/* Not in any region of the address space */
+		splx(spl);
+		return EFAULT;
+	}
+
+	/* Wait out any page-in or page-out of this page. */
+	while (*pte & PTE_BUSY) {
+		thread_sleep(pte);
+	}
+
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_WRITE) == 0) {
+		splx(spl);
+		return EFAULT;
+	}
+
+	if (faulttype == VM_FAULT_READ &&
+	    (*pte & (PTE_VALID | PTE_SWAPPED | PTE_FILE)) == 0) {
+		/*
+		 * Never written and nothing to load: read it through the
+		 * zero page until the first write gives it its own frame.
+		 */
+		_vmstats_inc(VMSTAT_TLB_RELOAD);
+		_vmstats_inc(VMSTAT_ZERO_PAGE_MAP);
+		paddr = vm_zeropage;
+		writable = 0;
+	}
+	else {
+		if ((*pte & PTE_VALID) == 0) {
+			int result = vm_pagein(as, faultaddress, pte, &paddr);
+			if (result) {
+				splx(spl);
+				return result;
 			}
-			else
-			{
-				_vmstats_inc(VMSTAT_TLB_RELOAD);
-				paddr = e->paddr;
+			//DEBUG(DB_VM, "VM: Allocated 0x%x at physical address 0x%x\n", faultaddress, paddr);
+		}
+		else {
+			_vmstats_inc(VMSTAT_TLB_RELOAD);
+			coremap_count_fault(1);
+			paddr = PTE_FRAME(*pte);
+		}
+
+		/*
+		 * Shared frames and pages without write permission are
+		 * mapped read-only. Writing a shared page gets a private
+		 * copy.
+		 */
+		writable = coremap_private(paddr, as, faultaddress);
+		if (faulttype != VM_FAULT_READ && !writable) {
+			int result = vm_copyonwrite(as, faultaddress, pte, &paddr);
+			if (result) {
+				splx(spl);
+				return result;
 			}
-			break;
+			writable = 1;
+		}
+		if ((*pte & PTE_WRITE) == 0) {
+			writable = 0;
 		}
 	}
-	#endif
 
-	#if OPT_A3
 	_vmstats_inc(VMSTAT_TLB_FAULT);
 
-	int dirty = ((e->flags & 0x2)? TLBLO_DIRTY : 0);
+	/* For the TLB and page replacement policies: this page was used. */
+	*pte |= PTE_REF | PTE_ACCESSED;
 
-	ehi = faultaddress;
-	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-	if (dirty & TLB_Probe(ehi, elo) >= 0)
-	{
-		i = TLB_Probe(ehi, elo);
-	}
-	else
-	{
-		i = tlb_get_rr_victim();
-	}
 	//DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-	TLB_Write(ehi, elo, i);
+	tlb_load(faultaddress, paddr, writable);
 	splx(spl);
 	return 0;
 	#else
@@ -15,7 +15,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <syscall.h>
 #include <synch.h>
 #include <machine/spl.h>
 #include "vmstats.h"
@@ -23,7 +25,8 @@
 /* Counters for tracking statistics */
 static unsigned int stats_counts[VMSTAT_COUNT];
 
-static struct lock *stats_lock = 0;
+static struct spinlock stats_lock;
+static int stats_ready = 0;
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -34,6 +37,13 @@ static const char *stats_names[] = {
  /* 4 */ "TLB Reloads",
  /* 5 */ "Page Faults (Zeroed)",
  /* 6 */ "Page Faults (Disk)",
+ /* 7 */ "Page Outs",
+ /* 8 */ "Page Outs (Daemon)",
+ /* 9 */ "Copy-on-Write Faults",
+ /* 10 */ "Page Faults from ELF",
+ /* 11 */ "ASID Allocations",
+ /* 12 */ "ASID Rollovers",
+ /* 13 */ "Zero Page Maps",
 };
 
 
@@ -42,18 +52,14 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-  /* If interrupts are already off we might be in an interrupt
-   * handler and we don't need to and can not use a lock
+  /* The spinlock is safe to take in interrupt handlers too,
+   * and costs no more than turning interrupts off
    */
-  if (curspl == SPL_HIGH) {
+  /* simple check that vmstat_init has been called */
+  assert(stats_ready);
+  spinlock_acquire(&stats_lock);
     _vmstats_inc(index);
-  } else {
-    /* simple check that vmstat_init has been called */
-    assert(stats_lock);
-    lock_acquire(stats_lock);
-      _vmstats_inc(index);
-    lock_release(stats_lock);
-  }
+  spinlock_release(&stats_lock);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -61,13 +67,13 @@ void
 vmstats_init()
 {
   /* Ensure this only gets called once */
-  assert(stats_lock == 0);
-  stats_lock = lock_create("StatsLock");
-  assert(stats_lock != 0);
+  assert(stats_ready == 0);
+  spinlock_init(&stats_lock);
+  stats_ready = 1;
 
-  lock_acquire(stats_lock);
+  spinlock_acquire(&stats_lock);
     _vmstats_init();
-  lock_release(stats_lock);
+  spinlock_release(&stats_lock);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -76,10 +82,10 @@ void
 vmstats_print()
 {
   /* simple check that vmstat_init has been called */
-  assert(stats_lock);
-  lock_acquire(stats_lock);
+  assert(stats_ready);
+  spinlock_acquire(&stats_lock);
     _vmstats_print();
-  lock_release(stats_lock);
+  spinlock_release(&stats_lock);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -140,6 +146,32 @@ _vmstats_print()
   }
 
 }
+
+/* ---------------------------------------------------------------------- */
+/* The __vmstat system call: copy the first NCOUNTS counters out to
+ * user space and return how many counters there are. This lets
+ * user-level benchmarks read fault counts before and after a run.
+ */
+int
+sys___vmstat(userptr_t counts, int ncounts, int *retval)
+{
+  unsigned int snapshot[VMSTAT_COUNT];
+  int spl;
+
+  if (ncounts < 0) {
+    return EINVAL;
+  }
+  if (ncounts > VMSTAT_COUNT) {
+    ncounts = VMSTAT_COUNT;
+  }
+
+  spl = splhigh();
+    memcpy(snapshot, stats_counts, sizeof(snapshot));
+  splx(spl);
+
+  *retval = VMSTAT_COUNT;
+  return copyout(snapshot, counts, ncounts * sizeof(unsigned int));
+}
 /* ---------------------------------------------------------------------- */
 
 #endif /* OPT_A3 */
@@ -0,0 +1,236 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <addrspace.h>
+#include <vmstats.h>
+#include <vmtlb.h>
+#include <machine/spl.h>
+#include <machine/tlb.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#define TLB_POLICY_RR		0
+#define TLB_POLICY_RANDOM	1
+#define TLB_POLICY_CLOCK	2
+
+static const char *tlb_policy_names[] = {
+	"rr",
+	"random",
+	"clock",
+	NULL
+};
+
+static int tlb_policy = TLB_POLICY_RR;
+
+/* Slots at or above this have been invalid since the last flush. */
+static int tlb_nextfree = 0;
+
+/* Round-robin victim and clock hand. */
+static int tlb_hand = 0;
+
+/*
+ * Address space IDs. ASIDs are handed out in order; when they run out,
+ * a new generation starts, the whole TLB is flushed and everyone gets
+ * a new one when next activated. ASID 0 is never handed out, so it
+ * stands for "no address space".
+ */
+#define TLB_NASID	((TLBHI_PID >> TLBHI_PID_SHIFT) + 1)
+#define TLB_EHI(vaddr, asid) \
+	(((vaddr) & TLBHI_VPAGE) | ((asid) << TLBHI_PID_SHIFT))
+
+static struct addrspace *tlb_asid_owner[TLB_NASID];
+static u_int32_t tlb_asid_gen = 1;	/* 0 means "never had an ASID" */
+static u_int32_t tlb_asid_next = 1;
+static u_int32_t tlb_curasid = 0;	/* what ENTRYHI should hold */
+
+int
+tlb_set_policy(const char *name)
+{
+	int i;
+
+	for (i = 0; tlb_policy_names[i] != NULL; i++) {
+		if (!strcmp(name, tlb_policy_names[i])) {
+			tlb_policy = i;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+tlb_policy_name(void)
+{
+	return tlb_policy_names[tlb_policy];
+}
+
+/*
+ * Second chance: walk the hand over the slots, passing over entries
+ * whose page has been loaded since the hand last came by. Gives up
+ * after two turns, which can only happen if the page table keeps
+ * changing under us, and takes whatever the hand points at. Entries
+ * of address spaces that no longer have an ASID go first.
+ */
+static
+int
+tlb_clock_victim(void)
+{
+	struct addrspace *as;
+	u_int32_t ehi, elo;
+	pte_t *pte;
+	int n, i;
+
+	for (n = 0; n < 2 * NUM_TLB; n++) {
+		i = tlb_hand;
+		tlb_hand = (tlb_hand + 1) % NUM_TLB;
+
+		TLB_Read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) == 0 ||
+		    (ehi & TLBHI_VPAGE) >= USERTOP) {
+			break;
+		}
+		as = tlb_asid_owner[(ehi & TLBHI_PID) >> TLBHI_PID_SHIFT];
+		if (as == NULL) {
+			break;
+		}
+		pte = as_lookup_pte(as, ehi & TLBHI_VPAGE, 0);
+		if (pte == NULL || (*pte & PTE_REF) == 0) {
+			break;
+		}
+		*pte &= ~PTE_REF;
+	}
+
+	/* TLB_Read replaced ENTRYHI. */
+	TLB_SetASID(tlb_curasid);
+	return (tlb_hand + NUM_TLB - 1) % NUM_TLB;
+}
+
+void
+tlb_load(vaddr_t vaddr, paddr_t paddr, int writable)
+{
+	u_int32_t ehi, elo;
+	int i;
+
+	assert(curspl>0);
+
+	assert(tlb_curasid != 0);
+
+	ehi = TLB_EHI(vaddr, tlb_curasid);
+	elo = paddr | TLBLO_VALID;
+	if (writable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Upgrading a read-only entry (copy-on-write) reuses its slot. */
+	i = TLB_Probe(ehi, 0);
+	if (i >= 0) {
+		_vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+		TLB_Write(ehi, elo, i);
+		return;
+	}
+
+	if (tlb_nextfree < NUM_TLB) {
+		_vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		TLB_Write(ehi, elo, tlb_nextfree++);
+		return;
+	}
+
+	_vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	switch (tlb_policy) {
+	    case TLB_POLICY_RANDOM:
+		TLB_Random(ehi, elo);
+		break;
+	    case TLB_POLICY_CLOCK:
+		TLB_Write(ehi, elo, tlb_clock_victim());
+		break;
+	    default:
+		TLB_Write(ehi, elo, tlb_hand);
+		tlb_hand = (tlb_hand + 1) % NUM_TLB;
+		break;
+	}
+}
+
+static
+void
+tlb_flush(void)
+{
+	int i;
+
+	assert(curspl>0);
+
+	for (i=0; i<NUM_TLB; i++) {
+		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	TLB_SetASID(tlb_curasid);
+	tlb_nextfree = 0;
+	tlb_hand = 0;
+
+	_vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+void
+tlb_activate(struct addrspace *as)
+{
+	assert(curspl>0);
+
+	if (as->as_asid_gen != tlb_asid_gen) {
+		if (tlb_asid_next == TLB_NASID) {
+			/* Out of ASIDs; everybody's entries go. */
+			tlb_asid_gen++;
+			if (tlb_asid_gen == 0) {
+				tlb_asid_gen = 1;
+			}
+			tlb_asid_next = 1;
+			bzero(tlb_asid_owner, sizeof(tlb_asid_owner));
+			tlb_flush();
+			_vmstats_inc(VMSTAT_ASID_ROLLOVER);
+		}
+		as->as_asid = tlb_asid_next++;
+		as->as_asid_gen = tlb_asid_gen;
+		tlb_asid_owner[as->as_asid] = as;
+		_vmstats_inc(VMSTAT_ASID_ALLOC);
+	}
+
+	tlb_curasid = as->as_asid;
+	TLB_SetASID(tlb_curasid);
+}
+
+void
+tlb_forget(struct addrspace *as)
+{
+	assert(curspl>0);
+
+	if (as->as_asid_gen == tlb_asid_gen) {
+		tlb_asid_owner[as->as_asid] = NULL;
+		if (as->as_asid == tlb_curasid) {
+			tlb_curasid = 0;
+			TLB_SetASID(0);
+		}
+	}
+	as->as_asid_gen = 0;
+}
+
+/*
+ * Throw away any TLB entry for VADDR in AS. The slot is simply left
+ * invalid until the policy picks it again.
+ */
+void
+tlb_invalidate_page(struct addrspace *as, vaddr_t vaddr)
+{
+	int i;
+
+	assert(curspl>0);
+
+	if (as->as_asid_gen != tlb_asid_gen) {
+		/* Can't have any entries. */
+		return;
+	}
+
+	i = TLB_Probe(TLB_EHI(vaddr, as->as_asid), 0);
+	if (i >= 0) {
+		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	TLB_SetASID(tlb_curasid);
+}
+
+#endif /* OPT_A3 */
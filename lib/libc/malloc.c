@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * malloc/free: ANSI C
+ *
+ * The heap is one contiguous arena grown and shrunk with sbrk(). Every
+ * block starts with a header holding its own size and the size of the
+ * block before it, so both neighbours can be found from a block in
+ * constant time (boundary tags). Free blocks are kept on a doubly
+ * linked list threaded through their payload; allocation is first fit
+ * on that list, splitting off whatever is left over. free() merges a
+ * block with free neighbours straight away, and gives the end of the
+ * arena back to the kernel when a large enough free block sits there.
+ *
+ * Block sizes include the header and are multiples of 8, which leaves
+ * the low bit free to mark a block in use.
+ */
+
+struct mheader {
+	size_t mh_size;		/* size of this block, MH_INUSE or'd in */
+	size_t mh_prevsize;	/* size of the block before; 0 if first */
+};
+
+/* Free blocks also carry their list links, right after the header. */
+struct mfree {
+	struct mheader mf_hdr;
+	struct mfree *mf_next;
+	struct mfree *mf_prev;
+};
+
+#define MH_INUSE	1
+#define MH_SIZE(mh)	((mh)->mh_size & ~(size_t)MH_INUSE)
+
+#define MALLOC_ALIGN	8
+#define MIN_BLOCK	sizeof(struct mfree)
+#define MAX_REQUEST	0x7ff00000
+
+/* Grow the arena at least this much at a time. */
+#define GROW_SIZE	16384
+
+/* Give back the end of the arena once this much of it is free. */
+#define TRIM_SIZE	65536
+
+#define ROUNDUP(x, a)	(((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+static char *heap_start;		/* first block */
+static char *heap_end;			/* current break */
+static struct mheader *heap_last;	/* last block, or NULL if none */
+static struct mfree *freelist;
+
+static
+struct mheader *
+nextblock(struct mheader *mh)
+{
+	char *next = (char *)mh + MH_SIZE(mh);
+
+	return next < heap_end ? (struct mheader *)next : NULL;
+}
+
+static
+struct mheader *
+prevblock(struct mheader *mh)
+{
+	if (mh->mh_prevsize == 0) {
+		return NULL;
+	}
+	return (struct mheader *)((char *)mh - mh->mh_prevsize);
+}
+
+/*
+ * Set MH's size, keeping the next block's back pointer in step.
+ */
+static
+void
+setsize(struct mheader *mh, size_t size)
+{
+	struct mheader *next;
+
+	mh->mh_size = size | (mh->mh_size & MH_INUSE);
+	next = nextblock(mh);
+	if (next != NULL) {
+		next->mh_prevsize = size;
+	}
+}
+
+static
+void
+freelist_insert(struct mheader *mh)
+{
+	struct mfree *mf = (struct mfree *)mh;
+
+	mf->mf_prev = NULL;
+	mf->mf_next = freelist;
+	if (freelist != NULL) {
+		freelist->mf_prev = mf;
+	}
+	freelist = mf;
+}
+
+static
+void
+freelist_remove(struct mheader *mh)
+{
+	struct mfree *mf = (struct mfree *)mh;
+
+	if (mf->mf_prev != NULL) {
+		mf->mf_prev->mf_next = mf->mf_next;
+	}
+	else {
+		freelist = mf->mf_next;
+	}
+	if (mf->mf_next != NULL) {
+		mf->mf_next->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * Merge free block MH (not on the free list) with any free neighbours
+ * and put the result on the free list. Returns the merged block.
+ */
+static
+struct mheader *
+release(struct mheader *mh)
+{
+	struct mheader *other;
+
+	other = nextblock(mh);
+	if (other != NULL && (other->mh_size & MH_INUSE) == 0) {
+		freelist_remove(other);
+		if (other == heap_last) {
+			heap_last = mh;
+		}
+		setsize(mh, MH_SIZE(mh) + MH_SIZE(other));
+	}
+
+	other = prevblock(mh);
+	if (other != NULL && (other->mh_size & MH_INUSE) == 0) {
+		freelist_remove(other);
+		if (mh == heap_last) {
+			heap_last = other;
+		}
+		setsize(other, MH_SIZE(other) + MH_SIZE(mh));
+		mh = other;
+	}
+
+	freelist_insert(mh);
+	return mh;
+}
+
+/*
+ * Cut free block MH (off the free list) down to SIZE bytes, releasing
+ * the rest as a new free block if it's big enough to be one.
+ */
+static
+void
+split(struct mheader *mh, size_t size)
+{
+	struct mheader *rest;
+	size_t restsize = MH_SIZE(mh) - size;
+
+	if (restsize < MIN_BLOCK) {
+		return;
+	}
+
+	setsize(mh, size);
+	rest = (struct mheader *)((char *)mh + size);
+	rest->mh_size = 0;
+	rest->mh_prevsize = size;
+	if (mh == heap_last) {
+		heap_last = rest;
+	}
+	setsize(rest, restsize);
+	freelist_insert(rest);
+}
+
+/*
+ * Extend the arena so a block of SIZE bytes fits, and return the
+ * resulting free block (merged with a free block already at the end).
+ */
+static
+struct mheader *
+grow(size_t size)
+{
+	struct mheader *mh;
+	size_t amount;
+	void *p;
+
+	if (heap_start == NULL) {
+		p = sbrk(0);
+		if (p == (void *)-1) {
+			return NULL;
+		}
+		heap_start = heap_end = p;
+		amount = ROUNDUP((uintptr_t)heap_start, MALLOC_ALIGN)
+			- (uintptr_t)heap_start;
+		if (amount > 0) {
+			if (sbrk(amount) == (void *)-1) {
+				heap_start = NULL;
+				return NULL;
+			}
+			heap_start = heap_end = heap_start + amount;
+		}
+	}
+
+	/* A free block at the end only needs topping up. */
+	amount = size;
+	if (heap_last != NULL && (heap_last->mh_size & MH_INUSE) == 0) {
+		amount -= MH_SIZE(heap_last);
+	}
+	if (amount < GROW_SIZE) {
+		amount = GROW_SIZE;
+	}
+
+	p = sbrk(amount);
+	if (p == (void *)-1) {
+		return NULL;
+	}
+	if ((char *)p != heap_end) {
+		/* Someone else moved the break; we can't cope with that. */
+		errx(1, "malloc: heap break moved behind our back");
+	}
+
+	mh = (struct mheader *)heap_end;
+	mh->mh_size = 0;
+	mh->mh_prevsize = heap_last != NULL ? MH_SIZE(heap_last) : 0;
+	heap_end += amount;
+	heap_last = mh;
+	setsize(mh, amount);
+
+	return release(mh);
+}
+
+/*
+ * Hand a large free block at the end of the arena back to the kernel.
+ */
+static
+void
+trim(void)
+{
+	struct mheader *mh = heap_last;
+	size_t size;
+
+	if (mh == NULL || (mh->mh_size & MH_INUSE) != 0 ||
+	    MH_SIZE(mh) < TRIM_SIZE) {
+		return;
+	}
+
+	size = MH_SIZE(mh);
+	if (sbrk(-(int)size) == (void *)-1) {
+		return;
+	}
+	freelist_remove(mh);
+	heap_last = prevblock(mh);
+	heap_end -= size;
+}
+
+void *
+malloc(size_t size)
+{
+	struct mfree *mf;
+	struct mheader *mh;
+
+	if (size > MAX_REQUEST) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = ROUNDUP(size, MALLOC_ALIGN) + sizeof(struct mheader);
+	if (size < MIN_BLOCK) {
+		size = MIN_BLOCK;
+	}
+
+	for (mf = freelist; mf != NULL; mf = mf->mf_next) {
+		if (MH_SIZE(&mf->mf_hdr) >= size) {
+			break;
+		}
+	}
+
+	if (mf != NULL) {
+		mh = &mf->mf_hdr;
+	}
+	else {
+		mh = grow(size);
+		if (mh == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	freelist_remove(mh);
+	split(mh, size);
+	mh->mh_size |= MH_INUSE;
+	return mh + 1;
+}
+
+void
+free(void *ptr)
+{
+	struct mheader *mh;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	mh = (struct mheader *)ptr - 1;
+	if ((char *)mh < heap_start || (char *)mh >= heap_end ||
+	    (mh->mh_size & MH_INUSE) == 0) {
+		errx(1, "free: bad pointer %p", ptr);
+	}
+
+	mh->mh_size &= ~(size_t)MH_INUSE;
+	release(mh);
+	trim();
+}
@@ -591,6 +591,57 @@ test7(void)
 	test567(7, seed);
 }
 
+/*
+ * Test 8
+ *
+ * Allocation throughput: time a long run of malloc/free pairs of
+ * mixed sizes, with a window of blocks kept live so the free list
+ * doesn't stay trivially short.
+ */
+
+#define T8_LIVE    64
+#define T8_ROUNDS  200000
+
+static
+void
+test8(void)
+{
+	static const size_t sizes[8] = { 8, 16, 40, 72, 200, 500, 1000, 4000 };
+	void *ptrs[T8_LIVE];
+	time_t s0, s1;
+	unsigned long ns0, ns1, usecs;
+	int i, n;
+
+	printf("Beginning malloc test 8\n");
+
+	for (i=0; i<T8_LIVE; i++) {
+		ptrs[i] = NULL;
+	}
+	srandom(8);
+
+	s0 = __time(NULL, &ns0);
+	for (i=0; i<T8_ROUNDS; i++) {
+		n = random()%T8_LIVE;
+		free(ptrs[n]);
+		ptrs[n] = malloc(sizes[random()%8]);
+		if (ptrs[n] == NULL) {
+			printf("FAILED: malloc failed after %d rounds\n", i);
+			break;
+		}
+	}
+	s1 = __time(NULL, &ns1);
+
+	for (i=0; i<T8_LIVE; i++) {
+		free(ptrs[i]);
+	}
+
+	usecs = (s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+	printf("%d malloc/free pairs in %lu.%06lu seconds (%lu ns each)\n",
+	       T8_ROUNDS, usecs / 1000000, usecs % 1000000,
+	       usecs / (T8_ROUNDS / 1000));
+	printf("Passed malloc test 8\n");
+}
+
 ////////////////////////////////////////////////////////////
 
 static struct {
@@ -605,6 +656,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Allocation throughput", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -0,0 +1,151 @@
+/*
+ * stridebench.c
+ *
+ * 	Measures how well the scheduler hands out CPU shares. Forks one
+ *	spinner per share given on the command line (default 100 200
+ *	300); each sets its share with setshare and counts loop
+ *	iterations until a common deadline. Each spinner leaves its
+ *	count in a file, and the parent reports every spinner's
+ *	fraction of the total next to the fraction its share asked for.
+ *
+ *	Run it under the stride scheduler, e.g. with the kernel
+ *	arguments "sched stride; p /testbin/stridebench 100 200 300".
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define MaxSpinners	16
+#define Seconds		10
+
+static int shares[MaxSpinners] = { 100, 200, 300 };
+static int nspinners = 3;
+
+static
+void
+countfile(int n, char *buf, size_t len)
+{
+	snprintf(buf, len, "stridebench.%d", n);
+}
+
+/*
+ * Spin until DEADLINE, then write out the number of iterations.
+ */
+static
+void
+spin(int n, time_t deadline)
+{
+	volatile unsigned long count = 0;
+	unsigned long result;
+	char name[32];
+	int fd, i;
+
+	if (setshare(shares[n]) < 0) {
+		err(1, "setshare");
+	}
+
+	while (time(NULL) < deadline) {
+		for (i = 0; i < 1000; i++) {
+			count++;
+		}
+	}
+
+	result = count;
+	countfile(n, name, sizeof(name));
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+		err(1, "%s: write", name);
+	}
+	close(fd);
+	_exit(0);
+}
+
+static
+unsigned long
+getcount(int n)
+{
+	unsigned long result;
+	char name[32];
+	int fd;
+
+	countfile(n, name, sizeof(name));
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (read(fd, &result, sizeof(result)) != sizeof(result)) {
+		errx(1, "%s: short read", name);
+	}
+	close(fd);
+	remove(name);
+	return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long counts[MaxSpinners], total;
+	pid_t pids[MaxSpinners];
+	int i, status, totalshares;
+	time_t deadline;
+
+	if (argc > 1) {
+		if (argc - 1 > MaxSpinners) {
+			errx(1, "At most %d spinners", MaxSpinners);
+		}
+		nspinners = argc - 1;
+		for (i = 0; i < nspinners; i++) {
+			shares[i] = atoi(argv[i+1]);
+			if (shares[i] <= 0) {
+				errx(1, "Bad share %s", argv[i+1]);
+			}
+		}
+	}
+
+	printf("stridebench: %d spinners for %d seconds\n",
+	       nspinners, Seconds);
+
+	deadline = time(NULL) + Seconds;
+	for (i = 0; i < nspinners; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			spin(i, deadline);
+		}
+	}
+
+	total = 0;
+	totalshares = 0;
+	for (i = 0; i < nspinners; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		counts[i] = getcount(i);
+		total += counts[i];
+		totalshares += shares[i];
+	}
+	if (total == 0) {
+		errx(1, "No work done");
+	}
+
+	/* Percentages to one decimal place, computed in per-mille. */
+	printf("%8s %6s %12s %8s %8s\n", "spinner", "share", "iterations",
+	       "got %", "want %");
+	for (i = 0; i < nspinners; i++) {
+		unsigned long got = counts[i] / (total / 1000 + 1);
+		unsigned long want = shares[i] * 1000 / totalshares;
+
+		printf("%8d %6d %12lu %6lu.%lu %6lu.%lu\n", i, shares[i],
+		       counts[i], got / 10, got % 10, want / 10, want % 10);
+	}
+	return 0;
+}
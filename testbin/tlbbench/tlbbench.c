@@ -0,0 +1,100 @@
+/*
+ * tlbbench.c
+ *
+ * 	Measures TLB behaviour. For a range of working-set sizes on
+ *	either side of the TLB's reach (64 entries * 4K = 256K) and a
+ *	few strides, it sweeps over the working set several times and
+ *	reports the TLB faults per access, read from the kernel's VM
+ *	statistics with __vmstat.
+ *
+ *	Run it under each TLB replacement policy to compare them, e.g.
+ *	with the kernel arguments "tlbpolicy clock; p /testbin/tlbbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PageSize	4096
+#define TLBSize		64
+#define MaxPages	192
+#define Rounds		8
+
+/* Counter numbers, from kern/include/vmstats.h */
+#define VMSTAT_TLB_FAULT		0
+#define VMSTAT_TLB_FAULT_REPLACE	2
+#define NumStats			3
+
+static const int npages[] = { 16, 32, 48, 56, 60, 64, 72, 96, 128, 192 };
+static const int strides[] = { PageSize, PageSize / 4, 64 };
+
+#define NELEM(a)	((int)(sizeof(a) / sizeof((a)[0])))
+
+char data[MaxPages * PageSize];
+
+static
+void
+readstats(unsigned int *stats)
+{
+	if (__vmstat(stats, NumStats) < 0) {
+		err(1, "__vmstat");
+	}
+}
+
+/*
+ * Touch every STRIDE'th byte of the first NPAGES pages, ROUNDS times.
+ * Returns the number of accesses.
+ */
+static
+unsigned long
+sweep(int npages, int stride)
+{
+	unsigned long n = 0;
+	int i, r, size;
+
+	size = npages * PageSize;
+	for (r = 0; r < Rounds; r++) {
+		for (i = 0; i < size; i += stride) {
+			data[i]++;
+			n++;
+		}
+	}
+	return n;
+}
+
+int
+main()
+{
+	unsigned int before[NumStats], after[NumStats];
+	unsigned long accesses, faults, replaces;
+	int p, s;
+
+	printf("tlbbench: %d TLB entries, %d rounds per sweep\n",
+	       TLBSize, Rounds);
+
+	/* Fault everything in first so we only count TLB misses. */
+	sweep(MaxPages, PageSize);
+
+	printf("%6s %8s %10s %10s %10s %14s\n", "pages", "stride",
+	       "accesses", "faults", "replaces", "faults/1000");
+
+	for (s = 0; s < NELEM(strides); s++) {
+		for (p = 0; p < NELEM(npages); p++) {
+			readstats(before);
+			accesses = sweep(npages[p], strides[s]);
+			readstats(after);
+
+			faults = after[VMSTAT_TLB_FAULT]
+				- before[VMSTAT_TLB_FAULT];
+			replaces = after[VMSTAT_TLB_FAULT_REPLACE]
+				- before[VMSTAT_TLB_FAULT_REPLACE];
+
+			printf("%6d %8d %10lu %10lu %10lu %14lu\n",
+			       npages[p], strides[s], accesses, faults,
+			       replaces, faults * 1000 / accesses);
+		}
+	}
+
+	return 0;
+}